@@ -20,6 +20,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "rusage.h"
 #include "proc.h"
 
 #define BACKSPACE 0x100
@@ -43,6 +44,7 @@ consputc(int c)
 
 struct {
   struct spinlock lock;
+  struct sleeplock rlock;  // held by the one reader
   
   // input
 #define INPUT_BUF 128
@@ -54,20 +56,26 @@ struct {
 
 //
 // user write()s to the console go here.
+// the bytes are copied in before cons.lock is
+// taken, since the copy may fault and sleep.
 //
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
-
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  int i, j, m;
+  char buf[32];
+
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    acquire(&cons.lock);
+    for(j = 0; j < m; j++)
+      uartputc(buf[j]);
+    release(&cons.lock);
   }
-  release(&cons.lock);
 
   return i;
 }
@@ -77,6 +85,9 @@ consolewrite(int user_src, uint64 src, int n)
 // copy (up to) a whole input line to dst.
 // user_dist indicates whether dst is a user
 // or kernel address.
+// each byte is copied out without cons.lock,
+// and consumed only if the copy succeeds;
+// cons.rlock keeps other readers out meanwhile.
 //
 int
 consoleread(int user_dst, uint64 dst, int n)
@@ -86,34 +97,41 @@ consoleread(int user_dst, uint64 dst, int n)
   char cbuf;
 
   target = n;
-  acquire(&cons.lock);
+  acquiresleep(&cons.rlock);
   while(n > 0){
     // wait until interrupt handler has put some
     // input into cons.buffer.
+    acquire(&cons.lock);
     while(cons.r == cons.w){
       if(myproc()->killed){
         release(&cons.lock);
+        releasesleep(&cons.rlock);
         return -1;
       }
       sleep(&cons.r, &cons.lock);
     }
-
-    c = cons.buf[cons.r++ % INPUT_BUF];
-
+    c = cons.buf[cons.r % INPUT_BUF];
     if(c == C('D')){  // end-of-file
-      if(n < target){
-        // Save ^D for next time, to make sure
-        // caller gets a 0-byte result.
-        cons.r--;
+      if(n == target){
+        // Consume ^D only if the caller gets
+        // a 0-byte result; else save it for
+        // next time.
+        cons.r++;
       }
+      release(&cons.lock);
       break;
     }
+    release(&cons.lock);
 
     // copy the input byte to the user-space buffer.
     cbuf = c;
     if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
       break;
 
+    acquire(&cons.lock);
+    cons.r++;
+    release(&cons.lock);
+
     dst++;
     --n;
 
@@ -123,7 +141,7 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
   }
-  release(&cons.lock);
+  releasesleep(&cons.rlock);
 
   return target - n;
 }
@@ -184,6 +202,7 @@ void
 consoleinit(void)
 {
   initlock(&cons.lock, "cons");
+  initsleeplock(&cons.rlock, "consread");
 
   uartinit();
 
@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -23,7 +24,7 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
-int             exec(char*, char**);
+int             exec(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -38,8 +39,11 @@ int             filewrite(struct file*, uint64, int n);
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+uint            dirinum(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            idenywrite(struct inode*);
+void            iallowwrite(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -63,6 +67,11 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
+void            ksplit_pages(void *, int);
+void            kdup(void *);
+int             krefcount(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -70,7 +79,14 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// pagecache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint);
+void            pcacheinval(struct inode*);
+int             pcachereclaim(void);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -85,7 +101,8 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+uint64          growproc(int);
+int             spawn(char*, char**, struct file**);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -98,8 +115,24 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
-int             wait(uint64);
+int             wait(uint64, uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
+int             procstats(char*, int);
+int             schedtick(void);
+int             setpriority(int, int);
+int             getrusage(int, uint64);
+int             setaffinity(int, int);
+int             getaffinity(int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+void            killthreads(struct proc*);
+void            tlbpoll(void);
+void            tlbshootdown(struct proc*);
+void            tlbrevoke(struct proc*, uint64, uint64);
+void            vmlock(struct proc*);
+void            vmunlock(struct proc*);
+struct inode*   cwdget(struct proc*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -108,6 +141,20 @@ void            procdump(void);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// swap.c
+void            swapinit(struct superblock*);
+int             swapin(pagetable_t, uint64);
+void            swapdup(pte_t);
+void            swapfree(pte_t);
+void*           kalloc_user(void);
+void            swapreserve(int);
+
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// stats.c
+void            statsinit(void);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -116,6 +163,11 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// slab.c
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -139,6 +191,18 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            timerinithart(void);
+int             timerintr(void);
+int             timersleep(uint64);
+void            timeridle(int);
+uint            timerticks(void);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
@@ -156,6 +220,7 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(struct proc*);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
@@ -163,14 +228,43 @@ pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, uint64, int);
+int             uvmzero(pagetable_t, uint64, int);
+int             vmstats(char*, int);
+int             mapmegapage(pagetable_t, uint64, uint64, int);
+int             uvmmegafault(pagetable_t, uint64);
+int             ismegapage(pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+void            uvmrevoke(pagetable_t, uint64, uint64);
+void            uvmshare(pagetable_t, pagetable_t);
+void            uvmunshare(pagetable_t);
 void            uvmclear(pagetable_t, uint64);
+pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmattach(pagetable_t, pagetable_t);
+
+// vmcopyin.c
+int             copyin_new(char *, uint64, uint64);
+int             copyout_new(uint64, char *, uint64);
+int             copyinstr_new(char *, uint64, uint64);
+
+// vma.c
+uint64          mmap(uint64, uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+void            munmapall(struct proc*);
+void            vmashrink(struct proc*, uint64, struct inode**);
+void            vmaput(struct proc*, struct inode*);
+int             vmacopy(struct proc*, struct proc*);
+uint64          vmabottom(struct proc*);
+int             pagefault(struct proc*, uint64, uint64);
+void            vmaprefault(uint64, uint64);
 
 // plic.c
 void            plicinit(void);
@@ -181,6 +275,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpage(uint, void *, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -3,23 +3,38 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
 #include "elf.h"
-
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
-
+#include "fcntl.h"
+
+// Replace the user image of p, which is either the
+// current process or a new one being built by spawn(),
+// with the program path. A thread can't, but its leader
+// can, and the other threads then go away.
+// The program's segments aren't read here: each becomes
+// a private mapping of the file, and usertrap() reads
+// in its pages, or zero-fills them, as they are touched.
+// The stack is a mapping without a file, which grows
+// down from MAXUVA the same way, to MAXSTACK pages.
 int
-exec(char *path, char **argv)
+exec(struct proc *p, char *path, char **argv)
 {
-  char *s, *last;
-  int i, off;
+  char *s, *last, *mem;
+  int i, off, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma segs[NVMA], *v;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+
+  if(p->group != p)
+    return -1;
 
   begin_op();
 
@@ -38,7 +53,7 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program's segments.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -46,33 +61,62 @@ exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > MAXUVA)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < sz)
       goto bad;
-    sz = sz1;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if(nseg >= NVMA)
       goto bad;
+    v = &segs[nseg++];
+    v->addr = ph.vaddr;
+    v->len = PGROUNDUP(ph.memsz);
+    v->prot = 0;
+    if(ph.flags & ELF_PROG_FLAG_READ)
+      v->prot |= PROT_READ;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      v->prot |= PROT_WRITE;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      v->prot |= PROT_EXEC;
+    v->flags = MAP_PRIVATE | VMA_EXEC;
+    v->ip = idup(ip);
+    idenywrite(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
-
-  // Allocate two pages at the next page boundary.
-  // Use the second as the user stack.
   sz = PGROUNDUP(sz);
-  uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
+
+  // The heap starts at sz; the stack is at the top of
+  // user memory. Allocate the stack's first page now,
+  // for the arguments.
+  if(nseg >= NVMA)
+    goto bad;
+  v = &segs[nseg++];
+  v->addr = MAXUVA - MAXSTACK*PGSIZE;
+  v->len = MAXSTACK*PGSIZE;
+  v->prot = PROT_READ | PROT_WRITE;
+  v->flags = MAP_PRIVATE | VMA_STACK;
+  v->ip = 0;
+  v->off = 0;
+  v->filesz = 0;
+  if((mem = kalloc_user()) == 0)
     goto bad;
-  sz = sz1;
-  uvmclear(pagetable, sz-2*PGSIZE);
-  sp = sz;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pagetable, MAXUVA - PGSIZE, PGSIZE, (uint64)mem,
+              PTE_R | PTE_W | PTE_U) != 0){
+    kfree(mem);
+    goto bad;
+  }
+  sp = MAXUVA;
   stackbase = sp - PGSIZE;
 
   // Push argument strings, prepare rest of stack in ustack.
@@ -109,49 +153,36 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  killthreads(p);
+  munmapall(p);
+  for(i = 0; i < nseg; i++)
+    p->vma[i] = segs[i];
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  kvmattach(p->kpagetable, pagetable);
   proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  if(pagetable)
+  if(pagetable){
+    uvmunmap(pagetable, MAXUVA - PGSIZE, 1, 1);
     proc_freepagetable(pagetable, sz);
+  }
   if(ip){
     iunlockput(ip);
     end_op();
   }
-  return -1;
-}
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  begin_op();
+  for(i = 0; i < nseg; i++){
+    if(segs[i].ip){
+      iallowwrite(segs[i].ip);
+      iput(segs[i].ip);
+    }
   }
-  
-  return 0;
+  end_op();
+  return -1;
 }
@@ -15,6 +15,7 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -44,6 +45,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swapinit(&sb);
 }
 
 // Zero a block.
@@ -118,6 +120,11 @@ bfree(int dev, uint b)
 // to inodes used by multiple processes. The cached
 // inodes include book-keeping information that is
 // not stored on disk: ip->ref and ip->valid.
+// In-memory inodes come from a slab cache and are
+// kept on a list, at most NINODE of them. Entries that
+// are no longer referenced stay cached, and are reused
+// least recently used first when the list is full or
+// the slab cache has no memory.
 //
 // An inode and its in-memory representation go through a
 // sequence of states before they can be used by the
@@ -128,17 +135,17 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
+//   may be reused if ip->ref is zero. Otherwise ip->ref
+//   tracks the number of in-memory pointers to the entry
+//   (open files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
 //   decrements ref.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, which stays set while the entry caches
+//   the inode, until iput() frees it on the disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -163,9 +170,10 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries and the list of them. Since ip->ref indicates whether
+// an entry is in use, and ip->dev and ip->inum indicate which
+// i-node an entry holds, one must hold icache.lock while using
+// any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -173,41 +181,48 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;  // struct inodes come from here
+  struct inode head;         // list of cached inodes, through next/prev,
+                             // the most recently used first
+  int ninode;                // number of cached inodes
 } icache;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode));
+  icache.head.next = &icache.head;
+  icache.head.prev = &icache.head;
 }
 
 static struct inode* iget(uint dev, uint inum);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
+// Returns an unlocked but allocated and referenced inode,
+// or 0 if there's no memory for it.
 struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
+      if((ip = iget(dev, inum)) == 0){
+        brelse(bp);
+        return 0;
+      }
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      return ip;
     }
     brelse(bp);
   }
@@ -239,34 +254,52 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if there's no memory for a new entry.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = icache.head.next; ip != &icache.head; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Allocate an inode cache entry, or else recycle
+  // the least recently used one.
+  if(icache.ninode < NINODE && (ip = kmem_cache_alloc(icache.cache)) != 0){
+    icache.ninode++;
+    initsleeplock(&ip->lock, "inode");
+  } else {
+    for(ip = icache.head.prev; ip != &icache.head; ip = ip->prev){
+      if(ip->ref == 0)
+        break;
+    }
+    if(ip == &icache.head){
+      if(icache.ninode >= NINODE)
+        panic("iget: no inodes");
+      release(&icache.lock);
+      return 0;
+    }
+    ip->prev->next = ip->next;
+    ip->next->prev = ip->prev;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->ntext = 0;
   ip->valid = 0;
+  ip->next = icache.head.next;
+  ip->prev = &icache.head;
+  icache.head.next->prev = ip;
+  icache.head.next = ip;
   release(&icache.lock);
 
   return ip;
@@ -283,6 +316,25 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Count a program segment that maps ip, which exec() makes
+// with ip locked. writei() and open(O_TRUNC) refuse to change
+// an inode while any remain, since a running program's pages
+// are read from the file as they are touched, and must all
+// come from the same version of it.
+void
+idenywrite(struct inode *ip)
+{
+  __sync_fetch_and_add(&ip->ntext, 1);
+}
+
+// Drop a count from idenywrite(), when the segment is unmapped.
+void
+iallowwrite(struct inode *ip)
+{
+  if(__sync_fetch_and_sub(&ip->ntext, 1) <= 0)
+    panic("iallowwrite");
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -353,7 +405,15 @@ iput(struct inode *ip)
     acquire(&icache.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    // keep it cached, as the most recently used.
+    ip->prev->next = ip->next;
+    ip->next->prev = ip->prev;
+    ip->next = icache.head.next;
+    ip->prev = &icache.head;
+    icache.head.next->prev = ip;
+    icache.head.next = ip;
+  }
   release(&icache.lock);
 }
 
@@ -413,6 +473,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcacheinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -489,7 +550,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->ntext > 0)
+    return -1;  // text of a running program
 
+  pcacheinval(ip);
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -523,10 +587,11 @@ namecmp(const char *s, const char *t)
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+// Returns the entry's inode number, or 0 if not found.
+uint
+dirinum(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off;
   struct dirent de;
 
   if(dp->type != T_DIR)
@@ -541,27 +606,37 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       // entry matches path element
       if(poff)
         *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+      return de.inum;
     }
   }
 
   return 0;
 }
 
+// Look for a directory entry in a directory, as dirinum()
+// does, and return its inode.
+// Returns 0 if not found, or if there's no memory for
+// the inode; dirinum() tells the two apart.
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint inum;
+
+  if((inum = dirinum(dp, name, poff)) == 0)
+    return 0;
+  return iget(dp->dev, inum);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
   struct dirent de;
-  struct inode *ip;
 
   // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
+  if(dirinum(dp, name, 0) != 0)
     return -1;
-  }
 
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
@@ -627,10 +702,12 @@ namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
-  if(*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  if(*path == '/'){
+    if((ip = iget(ROOTDEV, ROOTINO)) == 0)
+      return 0;
+  } else {
+    ip = cwdget(myproc());
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
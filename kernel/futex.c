@@ -0,0 +1,107 @@
+//
+// Futexes, on which user-space locks and condition variables
+// wait, so that they only enter the kernel when they must.
+//
+// futex_wait(addr, val) sleeps if the int at user address addr
+// still holds val, and futex_wake(addr, n) wakes up to n of the
+// threads sleeping there. A futex is known by the physical
+// address of its int, which is also the channel its waiters
+// sleep on, so processes that share the page with mmap() share
+// the futex. futexwait() looks at the int and goes to sleep
+// holding the lock of the futex's hash bucket, which
+// futexwake() holds to wake it, so no wakeup can come between.
+//
+// The page is faulted in as if for a store first, so that it
+// is private: a copy-on-write fault could otherwise move the
+// int to another page after a thread began to wait at the old
+// one. Waiters may be woken for no reason, e.g. if the page
+// is freed and used for another futex, and must look again.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+struct spinlock futexlk[NFUTEX];
+
+#define FUTEXLK(pa) (&futexlk[((pa) >> 2) % NFUTEX])
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futexlk[i], "futex");
+}
+
+// Return the physical address of the int at user address va,
+// faulting its page in for writing, with vmlock() held so
+// that it stays mapped. Returns 0 if va isn't aligned, or
+// isn't writable memory, without the lock.
+static uint64
+futexaddr(uint64 va)
+{
+  struct proc *p = myproc(), *g = p->group;
+  pte_t *pte;
+
+  if(va % sizeof(int) != 0 || va >= MAXUVA)
+    return 0;
+  for(;;){
+    vmlock(p);
+    pte = walk(g->pagetable, va, 0);
+    if(pte && (*pte & (PTE_V|PTE_U|PTE_W)) == (PTE_V|PTE_U|PTE_W))
+      return PTE2PA(*pte) + va % PGSIZE;
+    vmunlock(p);
+    if(pagefault(p, va, 15) < 0)
+      return 0;
+  }
+}
+
+// Sleep on the futex at user address addr if it holds val.
+// Returns 0 when woken, -1 at once if it doesn't hold val
+// or addr is bad.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  lk = FUTEXLK(pa);
+  acquire(lk);
+  if(*(volatile int *)pa != val){
+    release(lk);
+    vmunlock(p);
+    return -1;
+  }
+  vmunlock(p);
+  sleep((void*)pa, lk);
+  release(lk);
+  return 0;
+}
+
+// Wake up to n threads sleeping on the futex at user address
+// addr. Returns how many were woken, or -1 if addr is bad.
+int
+futexwake(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+  int woken;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  vmunlock(p);
+  lk = FUTEXLK(pa);
+  acquire(lk);
+  woken = wakeupn((void*)pa, n);
+  release(lk);
+  return woken;
+}
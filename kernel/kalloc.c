@@ -1,6 +1,23 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// A binary buddy allocator manages [end, PHYSTOP) in
+// power-of-two blocks of 2^order pages, so callers can
+// get physically contiguous multi-page allocations with
+// kalloc_pages(order). Freed blocks are coalesced with
+// their buddies to limit fragmentation.
+//
+// Single pages, by far the common case, come from per-CPU
+// free lists in front of the buddy allocator, so that CPUs
+// allocating and freeing in parallel don't contend. A CPU
+// refills its list from the buddy allocator in batches,
+// returns a batch when its list grows too long, and steals
+// from another CPU's list when the buddy allocator is empty.
+//
+// Pages from kalloc() carry a reference count, so that
+// copy-on-write fork can share a page between page tables;
+// kfree() only frees a page when its last reference goes.
 
 #include "types.h"
 #include "param.h"
@@ -14,52 +31,295 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+#define MAXORDER 10   // largest block is 2^MAXORDER pages
+#define KSTEAL   64   // max pages moved by one steal from another CPU
+#define KBATCHORDER 5 // a CPU list refills with one 2^KBATCHORDER-page block
+#define KBATCH   (1 << KBATCHORDER)
+#define KHIGH    128  // a CPU list longer than this gives KBATCH pages back
+
+// physical page number, relative to KERNBASE.
+#define NPAGE      ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa)  (((uint64)(pa) - KERNBASE) >> PGSHIFT)
+#define PG2PA(pg)  (KERNBASE + ((uint64)(pg) << PGSHIFT))
+
+// a free page or block. prev is only used on the
+// buddy lists, which need unlinking from the middle.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;             // number of pages on freelist
+};
+
+struct kmem kmem[NCPU];
+
+struct {
+  struct spinlock lock;
+  struct run free[MAXORDER+1];  // circular lists of free blocks, by order
+  // order of the free block starting at each page,
+  // or -1 if no free block starts there.
+  char order[NPAGE];
+} buddy;
+
+// reference counts of pages allocated by kalloc(),
+// updated with atomic instructions rather than a lock.
+int pgref[NPAGE];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&buddy.lock, "buddy");
+  for(int o = 0; o <= MAXORDER; o++)
+    buddy.free[o].next = buddy.free[o].prev = &buddy.free[o];
+  memset(buddy.order, -1, sizeof(buddy.order));
   freerange(end, (void*)PHYSTOP);
 }
 
+static void buddy_free(void *pa, int order);
+
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
   for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+    buddy_free(p, 0);
+}
+
+// Buddy allocator.
+
+static void
+buddy_push(uint64 pg, int order)
+{
+  struct run *r = (struct run*)PG2PA(pg);
+  struct run *h = &buddy.free[order];
+
+  r->next = h->next;
+  r->prev = h;
+  h->next->prev = r;
+  h->next = r;
+  buddy.order[pg] = order;
+}
+
+static void
+buddy_unlink(uint64 pg)
+{
+  struct run *r = (struct run*)PG2PA(pg);
+
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  buddy.order[pg] = -1;
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Return a block of 2^order pages to the buddy allocator,
+// merging it with its buddy for as long as the buddy is free.
+// Pages below end are never free, so the kernel image is
+// never merged into a block.
+static void
+buddy_free(void *pa, int order)
+{
+  uint64 pg, b;
+
+  pg = PA2PG(pa);
+  acquire(&buddy.lock);
+  for(; order < MAXORDER; order++){
+    b = pg ^ (1L << order);
+    if(b >= NPAGE || buddy.order[b] != order)
+      break;
+    buddy_unlink(b);
+    if(b < pg)
+      pg = b;
+  }
+  buddy_push(pg, order);
+  release(&buddy.lock);
+}
+
+// Allocate a block of 2^order pages, splitting a larger
+// block if needed. Returns 0 if none is available.
+static void*
+buddy_alloc(int order)
+{
+  struct run *r;
+  uint64 pg;
+  int o;
+
+  acquire(&buddy.lock);
+  for(o = order; o <= MAXORDER; o++)
+    if(buddy.free[o].next != &buddy.free[o])
+      break;
+  if(o > MAXORDER){
+    release(&buddy.lock);
+    return 0;
+  }
+  r = buddy.free[o].next;
+  pg = PA2PG(r);
+  buddy_unlink(pg);
+  // give back the upper halves we don't need.
+  while(o > order){
+    o--;
+    buddy_push(pg + (1L << o), o);
+  }
+  release(&buddy.lock);
+  return (void*)r;
+}
+
+// Per-CPU lists of single pages.
+
+// Refill CPU id's list with a batch from the buddy allocator,
+// preferably one block split into KBATCH pages. Returns one
+// page for the caller, or 0 if the buddy allocator is empty.
+// Must be called with interrupts disabled.
+static struct run*
+krefill(int id)
+{
+  struct run *r, *first, *last;
+  char *pa;
+  int n, order;
+
+  order = KBATCHORDER;
+  if((pa = buddy_alloc(order)) == 0){
+    // too fragmented for a whole batch; take what there is.
+    order = 0;
+    if((pa = buddy_alloc(0)) == 0)
+      return 0;
+  }
+  n = 1 << order;
+
+  first = (struct run*)pa;
+  last = first;
+  for(int i = 1; i < n; i++){
+    r = (struct run*)(pa + i*PGSIZE);
+    last->next = r;
+    last = r;
+  }
+  if(n > 1){
+    acquire(&kmem[id].lock);
+    last->next = kmem[id].freelist;
+    kmem[id].freelist = first->next;
+    kmem[id].nfree += n - 1;
+    release(&kmem[id].lock);
+  }
+  return first;
+}
+
+// Take up to half (at most KSTEAL) of the pages on
+// another CPU's free list. Returns one page for the
+// caller and puts the rest on CPU id's own list.
+// Never holds two kmem locks at once, so two CPUs
+// stealing from each other can't deadlock.
+// Must be called with interrupts disabled.
+static struct run*
+ksteal(int id)
+{
+  struct kmem *victim;
+  struct run *first, *last;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    victim = &kmem[(id + i) % NCPU];
+    if(victim->nfree == 0)  // racy peek; avoids taking idle locks
+      continue;
+
+    acquire(&victim->lock);
+    n = (victim->nfree + 1) / 2;
+    if(n > KSTEAL)
+      n = KSTEAL;
+    first = last = victim->freelist;
+    if(first == 0){
+      release(&victim->lock);
+      continue;
+    }
+    for(int j = 1; j < n; j++)
+      last = last->next;
+    victim->freelist = last->next;
+    victim->nfree -= n;
+    release(&victim->lock);
+
+    if(n > 1){
+      acquire(&kmem[id].lock);
+      last->next = kmem[id].freelist;
+      kmem[id].freelist = first->next;
+      kmem[id].nfree += n - 1;
+      release(&kmem[id].lock);
+    }
+    return first;
+  }
+  return 0;
+}
+
+// Give every page on every CPU's list back to the buddy
+// allocator, so that they can coalesce into larger blocks.
+static void
+kdrain(void)
+{
+  struct run *r, *next;
+
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kmem[i].lock);
+    r = kmem[i].freelist;
+    kmem[i].freelist = 0;
+    kmem[i].nfree = 0;
+    release(&kmem[i].lock);
+    for(; r; r = next){
+      next = r->next;
+      buddy_free(r, 0);
+    }
+  }
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch;
+  struct kmem *km;
+  int ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  ref = __sync_sub_and_fetch(&pgref[PA2PG(pa)], 1);
+  if(ref < 0)
+    panic("kfree: ref");
+  if(ref > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
+  batch = 0;
+
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  if(km->nfree > KHIGH){
+    // too many cached pages; hand a batch back to the
+    // buddy allocator, where they can coalesce.
+    batch = km->freelist;
+    for(int i = 0; i < KBATCH; i++)
+      km->freelist = km->freelist->next;
+    km->nfree -= KBATCH;
+  }
+  release(&km->lock);
+  pop_off();
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  for(int i = 0; batch && i < KBATCH; i++){
+    r = batch->next;
+    buddy_free(batch, 0);
+    batch = r;
+  }
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +329,103 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+  acquire(&km->lock);
+  r = km->freelist;
+  if(r){
+    km->freelist = r->next;
+    km->nfree--;
+  }
+  release(&km->lock);
+  if(r == 0)
+    r = krefill(id);
+  if(r == 0)
+    r = ksteal(id);
+  pop_off();
 
-  if(r)
+  if(r){
     memset((char*)r, 5, PGSIZE); // fill with junk
+    pgref[PA2PG(r)] = 1;
+  } else if(pcachereclaim() > 0){
+    // cached program text that no process was using.
+    return kalloc();
+  }
   return (void*)r;
 }
+
+// Add a reference to a page allocated by kalloc().
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  if(__sync_fetch_and_add(&pgref[PA2PG(pa)], 1) < 1)
+    panic("kdup: free page");
+}
+
+// Number of references to a page allocated by kalloc().
+int
+krefcount(void *pa)
+{
+  return pgref[PA2PG(pa)];
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. kalloc_pages(0) is the same as kalloc().
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_pages(int order)
+{
+  char *pa;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_pages");
+  if(order == 0)
+    return kalloc();
+
+  if((pa = buddy_alloc(order)) == 0){
+    // pages cached on the per-CPU lists may be
+    // the buddies that would make a big enough block.
+    kdrain();
+    if((pa = buddy_alloc(order)) == 0)
+      return 0;
+  }
+  memset(pa, 5, PGSIZE << order); // fill with junk
+  return pa;
+}
+
+// Turn 2^order pages from kalloc_pages(order) into pages
+// that each have a reference count, as if from kalloc(),
+// so that they can be shared and freed one at a time.
+void
+ksplit_pages(void *pa, int order)
+{
+  if(order < 0 || order > MAXORDER || ((uint64)pa % (PGSIZE << order)) != 0)
+    panic("ksplit_pages");
+  for(int i = 0; i < (1 << order); i++)
+    pgref[PA2PG(pa) + i] = 1;
+}
+
+// Free 2^order pages allocated by kalloc_pages(order).
+void
+kfree_pages(void *pa, int order)
+{
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_pages");
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+
+  if(((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < end ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  memset(pa, 1, PGSIZE << order);
+  buddy_free(pa, order);
+}
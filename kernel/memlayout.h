@@ -27,9 +27,19 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
+// the kernel maps the CLINT again above MAXUVA, after
+// the PLIC, where every process's kernel page table has
+// it too, so that timer.c can set timer deadlines and
+// the scheduler can interrupt other harts.
+#define KCLINT (PLIC + 0x400000)
+#define KCLINT_MSIP(hartid) (KCLINT + 4*(hartid))
+#define KCLINT_MTIMECMP(hartid) (KCLINT + 0x4000 + 8*(hartid))
+#define KCLINT_MTIME (KCLINT + 0xBFF8)
+
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
@@ -59,9 +69,18 @@
 // Address zero first:
 //   text
 //   original data and bss
-//   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap()ed files
+//   guard page
+//   stack, growing down, at most MAXSTACK pages
+//   MAXUVA (the PLIC; devices above here)
+//   ...
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// user memory must end below the PLIC: each process's kernel
+// page table maps the user's memory at the same addresses,
+// alongside the kernel's mappings of the devices.
+#define MAXUVA PLIC
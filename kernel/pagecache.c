@@ -0,0 +1,173 @@
+// Page cache for program text.
+//
+// Processes running the same program share the physical
+// pages of its text, rather than each reading a private
+// copy from the file. vmafault() asks the cache for whole
+// pages of exec() segments; pages of writable segments are
+// mapped copy-on-write, so a store gets a private copy.
+//
+// Pages are keyed by (dev, inum, offset) and carry a page
+// reference (see kdup()) for the cache itself. Writing or
+// truncating an inode, which is refused while a process runs
+// it (see idenywrite()), drops its cached pages. Pages that
+// only the cache refers to are given back when kalloc() runs
+// out.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;
+  char *pa;          // 0 if the slot is free
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  int hand;          // where to look for a page to evict
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the cached page of ip at off, or 0.
+// Caller must hold pcache.lock.
+static struct pcpage*
+pclookup(uint dev, uint inum, uint off)
+{
+  struct pcpage *pg;
+
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->pa && pg->dev == dev && pg->inum == inum && pg->off == off)
+      return pg;
+  }
+  return 0;
+}
+
+// Find a slot for a new page: a free one, or else one
+// whose page no process maps any more. Returns 0 if
+// every cached page is in use.
+// Caller must hold pcache.lock.
+static struct pcpage*
+pcslot(void)
+{
+  struct pcpage *pg;
+  int i;
+
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->pa == 0)
+      return pg;
+  }
+  for(i = 0; i < NPCACHE; i++){
+    pg = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(krefcount(pg->pa) == 1){
+      kfree(pg->pa);
+      pg->pa = 0;
+      return pg;
+    }
+  }
+  return 0;
+}
+
+// Return the page of ip's contents at offset off, reading
+// it if it isn't cached, with a reference for the caller,
+// who must kfree() it when done. off need not be page
+// aligned. The caller must not hold ip's lock.
+// Returns 0 if out of memory or the read fails.
+char*
+pcacheget(struct inode *ip, uint off)
+{
+  struct pcpage *pg;
+  char *mem, *pa;
+
+  acquire(&pcache.lock);
+  if((pg = pclookup(ip->dev, ip->inum, off)) != 0){
+    pa = pg->pa;
+    kdup(pa);
+    release(&pcache.lock);
+    return pa;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc_user()) == 0)
+    return 0;
+
+  // hold ip's lock until the page is in the cache, so
+  // that a writei() can't slip in between and leave
+  // stale contents cached after its pcacheinval().
+  ilock(ip);
+  if(readi(ip, 0, (uint64)mem, off, PGSIZE) != PGSIZE){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+  acquire(&pcache.lock);
+  if((pg = pclookup(ip->dev, ip->inum, off)) != 0){
+    // another process read it first.
+    pa = pg->pa;
+    kdup(pa);
+    release(&pcache.lock);
+    iunlock(ip);
+    kfree(mem);
+    return pa;
+  }
+  if((pg = pcslot()) != 0){
+    pg->dev = ip->dev;
+    pg->inum = ip->inum;
+    pg->off = off;
+    pg->pa = mem;
+    kdup(mem);
+  }
+  release(&pcache.lock);
+  iunlock(ip);
+  return mem;
+}
+
+// ip's contents are changing: forget its cached pages.
+// Called by writei() and itrunc() with ip locked.
+void
+pcacheinval(struct inode *ip)
+{
+  struct pcpage *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->pa && pg->dev == ip->dev && pg->inum == ip->inum){
+      kfree(pg->pa);
+      pg->pa = 0;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Free the cached pages that no process maps.
+// Returns the number of pages freed.
+int
+pcachereclaim(void)
+{
+  struct pcpage *pg;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->pa && krefcount(pg->pa) == 1){
+      kfree(pg->pa);
+      pg->pa = 0;
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
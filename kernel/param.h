@@ -10,4 +10,14 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define NSWAP        2048  // pages in the swap area, after the file system
 #define MAXPATH      128   // maximum file path name
+#define NVMA         16    // mmap()ed regions per process
+#define MAXSTACK     256   // max pages of user stack
+#define NPCACHE      64    // pages in the program text cache
+#define NWAITQ       61    // hash buckets of sleeping processes
+#define NFUTEX       61    // hash buckets of futex locks
+#define NPRIO        3     // scheduling priority levels
+#define BOOSTTICKS   50    // ticks between priority boosts
+#define TICKCYCLES   1000000  // timer cycles per clock tick; about 1/10th second in qemu
+#define MSCYCLES     10000    // timer cycles per millisecond in qemu
@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -15,9 +16,41 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// join() and killthreads() sleep on a leader's nthread
+// holding join_lock, and a thread's exit wakes them up
+// holding it, so that none of its wakeups are lost.
+struct spinlock join_lock;
+
+extern uint ticks;
+
+// Sleeping processes are kept on wait queues, hashed by
+// channel, so that wakeup() only looks at processes that
+// are sleeping on the channel, or on one that hashes alike.
+// A process is on a queue from just before it sleeps until
+// it runs again; wakeup() still checks each one's state.
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;    // linked through p->wqnext and p->wqprev
+} waitq[NWAITQ];
+
+#define WAITQ(chan) (&waitq[((uint64)(chan) >> 3) % NWAITQ])
+
+// for the statistics device.
+static int nwakeup;     // calls to wakeup()
+static int nexamined;   // processes wakeup() looked at
+static int nipi;        // interrupts sent to idle CPUs
+static int nshootdown;  // calls to tlbshootdown() with other threads
+static int ntlbipi;     // interrupts it sent
+
+static int onlinecpus;  // mask of CPUs that have started scheduler()
+
+#define CPUMASK(c) (1 << ((c) - cpus))
+
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
+static uint boostgen(void);
 
 extern char trampoline[]; // trampoline.S
 
@@ -28,8 +61,14 @@ procinit(void)
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
+  initlock(&join_lock, "join");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&cpus[i].rqlock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      initlock(&p->vmlk, "vm");
 
       // Allocate a page for the process's kernel stack.
       // Map it high in memory, followed by an invalid
@@ -106,6 +145,17 @@ allocproc(void)
 
 found:
   p->pid = allocpid();
+  p->state = USED;
+  p->cpu = cpuid();
+  p->nice = 0;
+  p->affinity = (1 << NCPU) - 1;
+  p->prio = 0;
+  p->slice = 0;
+  p->boostgen = boostgen();
+  p->group = p;
+  p->nthread = 1;
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -121,6 +171,14 @@ found:
     return 0;
   }
 
+  // A kernel page table that shares the user's memory.
+  p->kpagetable = kvmcreate(p->pagetable);
+  if(p->kpagetable == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -139,16 +197,30 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
+  if(p->kpagetable)
+    kfree((void*)p->kpagetable);
+  p->kpagetable = 0;
+  if(p->pagetable && p->group != p){
+    // a thread's user memory belongs to its leader.
+    uvmunmap(p->pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(p->pagetable, TRAPFRAME, 1, 0);
+    uvmunshare(p->pagetable);
+  } else if(p->pagetable){
     proc_freepagetable(p->pagetable, p->sz);
+  }
   p->pagetable = 0;
   p->sz = 0;
+  p->group = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  // other harts may still hold TLB entries for p's ASID,
+  // so the next process here must not reuse it.
+  p->asidgen = 0;
+  p->tlbcpu = -1;
   p->state = UNUSED;
 }
 
@@ -167,9 +239,10 @@ proc_pagetable(struct proc *p)
   // map the trampoline code (for system call return)
   // at the highest user virtual address.
   // only the supervisor uses it, on the way
-  // to/from user space, so not PTE_U.
+  // to/from user space, so not PTE_U. it's global,
+  // like the kernel's own mapping of it.
   if(mappages(pagetable, TRAMPOLINE, PGSIZE,
-              (uint64)trampoline, PTE_R | PTE_X) < 0){
+              (uint64)trampoline, PTE_R | PTE_X | PTE_G) < 0){
     uvmfree(pagetable, 0);
     return 0;
   }
@@ -228,29 +301,49 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Growing only moves p->sz; the pages are allocated
+// by uvmfault() when they are first touched.
+// Shrinking frees the pages right away.
+// Return the old size, which sbrk() returns, or -1.
+uint64
 growproc(int n)
 {
-  uint sz;
-  struct proc *p = myproc();
+  uint64 sz, oldsz;
+  struct proc *p = myproc(), *g = p->group;
+  struct inode *put[NVMA];
+  int i;
 
-  sz = p->sz;
+  vmlock(p);
+  sz = oldsz = g->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > vmabottom(g)){
+      vmunlock(p);
       return -1;
     }
+    sz += n;
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(-n > sz){
+      vmunlock(p);
+      return -1;
+    }
+    tlbrevoke(p, PGROUNDUP(sz + n), PGROUNDUP(sz));
+    sz = uvmdealloc(g->pagetable, sz, sz + n);
+    sfence_vma(); // p->kpagetable shares the old mappings.
+    vmashrink(g, sz, put);
   }
-  p->sz = sz;
-  return 0;
+  g->sz = sz;
+  vmunlock(p);
+  if(n < 0){
+    for(i = 0; i < NVMA; i++)
+      vmaput(p, put[i]);
+  }
+  return oldsz;
 }
 
 // Create a new process, copying the parent.
@@ -260,22 +353,46 @@ fork(void)
 {
   int i, pid;
   struct proc *np;
-  struct proc *p = myproc();
+  struct proc *p = myproc(), *g = p->group;
+
+  // allocproc() and uvmcopy() allocate the child's page
+  // tables &c while holding np->lock.
+  swapreserve(8 + PGROUNDUP(g->sz) / (512*PGSIZE));
+
+  // other threads mustn't change the memory while it's copied.
+  vmlock(p);
 
   // Allocate process.
   if((np = allocproc()) == 0){
+    vmunlock(p);
     return -1;
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(g->pagetable, np->pagetable, 0, g->sz, 0) < 0){
     freeproc(np);
     release(&np->lock);
+    vmunlock(p);
     return -1;
   }
-  np->sz = p->sz;
+  np->sz = g->sz;
 
-  np->parent = p;
+  // the child starts at the top of the parent's range.
+  np->nice = np->prio = p->nice;
+  np->affinity = p->affinity;
+
+  // Copy mmap()ed regions.
+  if(vmacopy(g, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    vmunlock(p);
+    return -1;
+  }
+
+  // the pages are copy-on-write now, but other threads'
+  // TLBs may still let them write.
+  tlbshootdown(p);
+  vmunlock(p);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -284,22 +401,206 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  acquire(&g->lock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+    if(g->ofile[i])
+      np->ofile[i] = filedup(g->ofile[i]);
+  np->cwd = idup(g->cwd);
+  release(&g->lock);
+
+  np->parent = p;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  setrunnable(np);
 
   release(&np->lock);
 
   return pid;
 }
 
+// Create a new process running the program path with
+// arguments argv, without copying the current process's
+// memory. The child's open files are ofile[], whose
+// references spawn() takes over, even on failure.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct file **ofile)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0){
+    for(i = 0; i < NOFILE; i++)
+      if(ofile[i])
+        fileclose(ofile[i]);
+    return -1;
+  }
+  np->nice = np->prio = p->nice;
+  np->affinity = p->affinity;
+  // np is USED, so no one else will allocate it; exec()
+  // can sleep while loading the program without np->lock.
+  release(&np->lock);
+
+  for(i = 0; i < NOFILE; i++)
+    np->ofile[i] = ofile[i];
+  np->cwd = cwdget(p);
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+
+  if((argc = exec(np, path, argv)) < 0){
+    for(i = 0; i < NOFILE; i++){
+      if(np->ofile[i]){
+        fileclose(np->ofile[i]);
+        np->ofile[i] = 0;
+      }
+    }
+    begin_op();
+    iput(np->cwd);
+    end_op();
+    np->cwd = 0;
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  // argc goes to main() in a0, as from exec().
+  np->trapframe->a0 = argc;
+
+  acquire(&np->lock);
+  np->parent = p;
+  pid = np->pid;
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a thread: a process that shares the current one's
+// memory, open files and current directory, and starts in
+// user space at fn(arg), with its stack pointer at stack.
+// It has its own page table, whose user part is the
+// leader's, and its own trapframe, kernel stack and ASID.
+// Returns the new thread's id, a pid that join() takes,
+// or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int tid;
+  struct proc *np;
+  struct proc *p = myproc(), *g = p->group;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  uvmshare(np->pagetable, g->pagetable);
+  kvmattach(np->kpagetable, np->pagetable);
+  np->group = g;
+  np->nice = np->prio = p->nice;
+  np->affinity = p->affinity;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->trapframe->ra = 0; // fn must not return, but exit().
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  __sync_fetch_and_add(&g->nthread, 1);
+  tid = np->pid;
+
+  setrunnable(np);
+
+  release(&np->lock);
+
+  return tid;
+}
+
+// Wait for the thread tid of the current process's group
+// to exit, free it, and copy its exit status to user address
+// addr if it isn't 0. Any thread but the leader can be joined,
+// by any other. Returns tid, or -1 if there's no such thread.
+int
+join(int tid, uint64 addr)
+{
+  struct proc *t;
+  struct proc *p = myproc(), *g = p->group;
+  int found, xstate;
+
+  acquire(&join_lock);
+  for(;;){
+    found = 0;
+    for(t = proc; t < &proc[NPROC]; t++){
+      // t->group only changes when t is allocated or freed;
+      // look again holding t->lock.
+      if(t == p || t == g || t->group != g)
+        continue;
+      acquire(&t->lock);
+      if(t->group == g && t->pid == tid){
+        found = 1;
+        if(t->state == ZOMBIE){
+          xstate = t->xstate;
+          freeproc(t);
+          release(&t->lock);
+          release(&join_lock);
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
+          return tid;
+        }
+      }
+      release(&t->lock);
+    }
+
+    if(!found || p->killed){
+      release(&join_lock);
+      return -1;
+    }
+
+    // Wait for a thread to exit.
+    sleep(&g->nthread, &join_lock);
+  }
+}
+
+// Kill the other threads of p's group, whose leader p must
+// be, and wait for them to exit, freeing them. For exit()
+// and exec(), which can then treat p as a lone process.
+void
+killthreads(struct proc *p)
+{
+  struct proc *t;
+  int n;
+
+  if(p->group != p)
+    panic("killthreads");
+
+  acquire(&join_lock);
+  for(;;){
+    n = 0;
+    for(t = proc; t < &proc[NPROC]; t++){
+      if(t == p || t->group != p)
+        continue;
+      acquire(&t->lock);
+      if(t->group == p){
+        if(t->state == ZOMBIE){
+          freeproc(t);
+        } else {
+          t->killed = 1;
+          if(t->state == SLEEPING)
+            setrunnable(t);
+          n++;
+        }
+      }
+      release(&t->lock);
+    }
+    if(n == 0)
+      break;
+    sleep(&p->nthread, &join_lock);
+  }
+  release(&join_lock);
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold p->lock.
 void
@@ -326,6 +627,40 @@ reparent(struct proc *p)
   }
 }
 
+// exit() for a thread other than its group's leader, which
+// keeps the memory and files. The thread stays a zombie
+// until join() or its leader's killthreads() frees it.
+static void
+exitthread(int status)
+{
+  struct proc *p = myproc(), *g = p->group;
+
+  // as in exit(), for the children reparent() gives init.
+  acquire(&initproc->lock);
+  wakeup1(initproc);
+  release(&initproc->lock);
+
+  acquire(&join_lock);
+
+  // join() or killthreads() might be sleeping.
+  wakeup(&g->nthread);
+
+  acquire(&p->lock);
+
+  // Give any children to init.
+  reparent(p);
+
+  p->xstate = status;
+  p->state = ZOMBIE;
+  __sync_fetch_and_sub(&g->nthread, 1);
+
+  release(&join_lock);
+
+  // Jump into the scheduler, never to return.
+  sched();
+  panic("zombie exit");
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait().
@@ -337,6 +672,15 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  if(p->group != p)
+    exitthread(status);
+
+  // the other threads go too.
+  killthreads(p);
+
+  // Unmap mmap()ed files, writing back shared pages.
+  munmapall(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -392,14 +736,28 @@ exit(int status)
   panic("zombie exit");
 }
 
+static void
+ruadd(struct rusage *a, struct rusage *b)
+{
+  a->utime += b->utime;
+  a->stime += b->stime;
+  a->wtime += b->wtime;
+  a->nvcsw += b->nvcsw;
+  a->nivcsw += b->nivcsw;
+  a->nfault += b->nfault;
+}
+
 // Wait for a child process to exit and return its pid.
+// If ruaddr isn't 0, copy out the child's resource usage,
+// including that of the children it waited for.
 // Return -1 if this process has no children.
 int
-wait(uint64 addr)
+wait(uint64 addr, uint64 ruaddr)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
+  struct rusage ru;
 
   // hold p->lock for the whole time to avoid lost
   // wakeups from a child's exit().
@@ -418,14 +776,23 @@ wait(uint64 addr)
         acquire(&np->lock);
         havekids = 1;
         if(np->state == ZOMBIE){
-          // Found one.
+          // Found one. Copy out without the locks, since
+          // the copy may fault and sleep; np stays a
+          // zombie meanwhile, as only its parent frees it.
           pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
+          xstate = np->xstate;
+          ru = np->ru;
+          ruadd(&ru, &np->cru);
+          release(&np->lock);
+          release(&p->lock);
+          if((addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                   sizeof(xstate)) < 0) ||
+             (ruaddr != 0 && copyout(p->pagetable, ruaddr, (char *)&ru,
+                                     sizeof(ru)) < 0))
             return -1;
-          }
+          acquire(&p->lock);
+          acquire(&np->lock);
+          ruadd(&p->cru, &ru);
           freeproc(np);
           release(&np->lock);
           release(&p->lock);
@@ -446,10 +813,468 @@ wait(uint64 addr)
   }
 }
 
+// Each CPU has queues of RUNNABLE processes, so that
+// scheduler() doesn't have to look through all of proc[],
+// taking every process's lock, to find one. A process goes
+// on the queue of the CPU it last ran on, whose caches may
+// still hold its memory. A CPU whose queues are empty takes
+// work from another CPU's.
+//
+// The queues are a multi-level feedback queue: there is one
+// per priority level, and the scheduler runs the processes
+// of the highest level first, round robin. A process that
+// uses up its time slice at a level, 1<<level ticks of CPU
+// time, moves down a level; one that sleeps before that keeps
+// its level. Every BOOSTTICKS ticks, all processes go back
+// up to the level of their nice value, so that processes at
+// low levels don't starve.
+
+#define QUANTUM(prio) (1 << (prio))
+
+// the current priority boost. applied lazily: to the
+// run queues when a CPU next takes a process from them,
+// and to a process when it's next made RUNNABLE or
+// charged a tick.
+static uint
+boostgen(void)
+{
+  return ticks / BOOSTTICKS;
+}
+
+// Bring p's priority up to date with boosts.
+// Caller must hold p->lock.
+static void
+boost(struct proc *p)
+{
+  if(p->boostgen != boostgen()){
+    p->boostgen = boostgen();
+    p->prio = p->nice;
+    p->slice = 0;
+  }
+}
+
+// Append p to c's run queue at level prio.
+// Caller must hold c->rqlock.
+static void
+runqappend(struct cpu *c, struct proc *p, int prio)
+{
+  p->rqnext = 0;
+  if(c->rqtail[prio])
+    c->rqtail[prio]->rqnext = p;
+  else
+    c->rqhead[prio] = p;
+  c->rqtail[prio] = p;
+}
+
+// Send a software interrupt to CPU c, to get it out of the
+// wfi in scheduler(), or to flush its TLB. start.c arranges
+// for timervec to pass it on to supervisor mode.
+static void
+ipi(struct cpu *c)
+{
+  *(volatile uint32*)KCLINT_MSIP(c - cpus) = 1;
+}
+
+// Interrupt an idle CPU in mask, if there is one, to take
+// a process from a busy CPU's run queue.
+static void
+kickidle(int mask)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->idle && (mask & CPUMASK(c))){
+      __sync_fetch_and_add(&nipi, 1);
+      ipi(c);
+      return;
+    }
+  }
+}
+
+// Choose a CPU that p may run on, for setrunnable() when
+// p's own isn't one: an idle one, or else the least busy.
+static struct cpu*
+allowedcpu(struct proc *p)
+{
+  struct cpu *c, *best = 0;
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if((p->affinity & CPUMASK(c)) == 0)
+      continue;
+    if(c->idle)
+      return c;
+    if(best == 0 || c->nrunnable < best->nrunnable)
+      best = c;
+  }
+  return best;
+}
+
+// Make p RUNNABLE, and put it on the tail of its CPU's
+// run queue for its priority, moving it to another if its
+// affinity doesn't allow that CPU. If the CPU is idle, send
+// it an interrupt to run p; if it's busy and p has to wait
+// behind others, send one to an idle CPU to take p.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c = &cpus[p->cpu];
+  int n;
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  if((p->affinity & CPUMASK(c)) == 0){
+    c = allowedcpu(p);
+    p->cpu = c - cpus;
+  }
+  boost(p);
+  p->state = RUNNABLE;
+  p->readyat = r_time();
+  acquire(&c->rqlock);
+  runqappend(c, p, p->prio);
+  n = ++c->nrunnable;
+  release(&c->rqlock);
+
+  // scheduler() sets c->idle before its last look at
+  // the queues, so it either sees p or gets the interrupt.
+  if(c->idle){
+    if(c != mycpu()){
+      __sync_fetch_and_add(&nipi, 1);
+      ipi(c);
+    }
+  } else if(n > 1){
+    kickidle(p->affinity);
+  }
+}
+
+// Take the first process of the highest priority in c's
+// run queues that may run on CPU to, or 0.
+static struct proc*
+runqget(struct cpu *c, struct cpu *to)
+{
+  struct proc *p, *prev, *next;
+  struct proc *old[NPRIO];
+  int i;
+
+  acquire(&c->rqlock);
+  if(c->boostgen != boostgen()){
+    // requeue everything at its nice level. p->nice may
+    // change meanwhile, but it's only used as a hint here.
+    c->boostgen = boostgen();
+    for(i = 0; i < NPRIO; i++){
+      old[i] = c->rqhead[i];
+      c->rqhead[i] = c->rqtail[i] = 0;
+    }
+    for(i = 0; i < NPRIO; i++){
+      for(p = old[i]; p; p = next){
+        next = p->rqnext;
+        runqappend(c, p, p->nice);
+      }
+    }
+  }
+  // p->affinity may change meanwhile; scheduler()
+  // looks again while holding p->lock.
+  p = 0;
+  for(i = 0; i < NPRIO && p == 0; i++){
+    prev = 0;
+    for(p = c->rqhead[i]; p && (p->affinity & CPUMASK(to)) == 0; p = p->rqnext)
+      prev = p;
+    if(p){
+      if(prev)
+        prev->rqnext = p->rqnext;
+      else
+        c->rqhead[i] = p->rqnext;
+      if(c->rqtail[i] == p)
+        c->rqtail[i] = prev;
+      c->nrunnable--;
+    }
+  }
+  release(&c->rqlock);
+  return p;
+}
+
+// Charge a timer tick to the current process's time slice,
+// moving it down a priority level if it has used the slice
+// up. Called from usertrap() and kerneltrap().
+// Returns 1 if the process should yield: its slice is
+// over, or a process of higher priority is waiting.
+int
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+  int i, over = 0;
+
+  acquire(&p->lock);
+  c = mycpu();
+  boost(p);
+  if(++p->slice >= QUANTUM(p->prio)){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->slice = 0;
+    over = 1;
+  }
+  // a racy look at the queues; the next tick
+  // will catch anything missed.
+  for(i = 0; i < p->prio; i++){
+    if(c->rqhead[i])
+      over = 1;
+  }
+  release(&p->lock);
+
+  // idle CPUs have no ticks of their own to
+  // look for work with.
+  if(c->nrunnable > 0)
+    kickidle(-1);
+  return over;
+}
+
+// Set the nice value of the process pid, or of the current
+// process if pid is 0: the priority level, from 0 (highest)
+// to NPRIO-1, that it goes back to at a boost. It takes
+// effect right away.
+// Returns the old nice value, or -1 if there's no such
+// process or the value is out of range.
+int
+setpriority(int pid, int nice)
+{
+  struct proc *p;
+  int old;
+
+  if(nice < 0 || nice >= NPRIO)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      old = p->nice;
+      p->nice = nice;
+      p->prio = nice;
+      p->slice = 0;
+      release(&p->lock);
+      return old;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Set the CPUs that the process pid, or the current process
+// if pid is 0, may run on, as a mask of bits 1<<cpu; CPUs
+// that aren't running are left out. The current process
+// moves right away if it must.
+// Returns 0, or -1 if there's no such process or no CPU.
+int
+setaffinity(int pid, int mask)
+{
+  struct proc *p;
+  int move;
+
+  mask &= onlinecpus;
+  if(mask == 0)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->affinity = mask;
+      move = p == myproc() && (mask & CPUMASK(mycpu())) == 0;
+      release(&p->lock);
+      if(move)
+        yield();
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// The mask of CPUs that the process pid, or the current
+// process if pid is 0, may run on, or -1 if there's none.
+int
+getaffinity(int pid)
+{
+  struct proc *p;
+  int mask;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      mask = p->affinity & onlinecpus;
+      release(&p->lock);
+      return mask;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Threads share page tables, but each has its own ASID, so a
+// hart running one thread may hold TLB entries for memory that
+// another thread's hart has since unmapped or made copy-on-write.
+// tlbshootdown() asks the harts running the other threads to
+// flush their TLBs, with an interrupt, and waits for them.
+// Harts that wait with interrupts off, in acquire() or here,
+// poll for such requests, so that two harts can't each wait
+// for the other.
+
+// Flush this hart's TLB if tlbshootdown() has asked to.
+// Interrupts must be off.
+void
+tlbpoll(void)
+{
+  struct cpu *c = mycpu();
+  uint req = c->tlbreq;
+
+  if(req != c->tlbdone){
+    __sync_synchronize();
+    sfence_vma();
+    c->tlbdone = req;
+  }
+}
+
+// Make sure that no other thread of p's group can use TLB
+// entries from before a change to the group's page table,
+// which took away or cut down mappings. The caller flushes
+// its own hart's TLB. Threads that aren't running flush
+// when they next get a CPU (see kvmswitch()); this waits
+// for the harts of those that are.
+void
+tlbshootdown(struct proc *p)
+{
+  struct proc *t, *g = p->group;
+  struct cpu *c;
+  uint req[NCPU];
+  int mask = 0;
+
+  // only the caller can add a thread to a lone process.
+  if(g->nthread == 1)
+    return;
+  __sync_fetch_and_add(&nshootdown, 1);
+
+  for(t = proc; t < &proc[NPROC]; t++){
+    if(t == p || t->group != g)
+      continue;
+    acquire(&t->lock);
+    if(t->group == g){
+      t->tlbcpu = -1;
+      c = &cpus[t->cpu];
+      if(t->state == RUNNING && (mask & CPUMASK(c)) == 0){
+        // t can't leave c while this holds t->lock, and
+        // c flushes after seeing the request.
+        mask |= CPUMASK(c);
+        req[c - cpus] = __sync_add_and_fetch(&c->tlbreq, 1);
+        __sync_fetch_and_add(&ntlbipi, 1);
+        ipi(c);
+      }
+    }
+    release(&t->lock);
+  }
+
+  push_off();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if((mask & CPUMASK(c)) == 0)
+      continue;
+    while((int)(c->tlbdone - req[c - cpus]) < 0){
+      tlbpoll();
+      __sync_synchronize();
+    }
+  }
+  pop_off();
+}
+
+// Before freeing the pages of [va, end) of p's group, take
+// them away from its other threads: make their PTEs invalid,
+// keeping the pages for uvmunmap() to free, and shoot down
+// the threads' TLB entries. Caller must hold vmlock().
+void
+tlbrevoke(struct proc *p, uint64 va, uint64 end)
+{
+  if(p->group->nthread == 1 || va >= end)
+    return;
+  uvmrevoke(p->group->pagetable, va, (end - va) / PGSIZE);
+  tlbshootdown(p);
+}
+
+// Lock the address space of p's thread group against page
+// faults, sbrk(), mmap() &c by its other threads, which could
+// otherwise both map the same page, or change the mappings
+// under one another. Sleeps while another thread has it, so
+// the caller mustn't hold a spinlock; nothing copies to or
+// from user memory with one held, since the copy may fault.
+void
+vmlock(struct proc *p)
+{
+  struct proc *g = p->group;
+
+  acquire(&g->vmlk);
+  while(g->vmbusy)
+    sleep(&g->vmbusy, &g->vmlk);
+  g->vmbusy = 1;
+  release(&g->vmlk);
+}
+
+void
+vmunlock(struct proc *p)
+{
+  struct proc *g = p->group;
+
+  acquire(&g->vmlk);
+  g->vmbusy = 0;
+  wakeup(&g->vmbusy);
+  release(&g->vmlk);
+}
+
+// Return a new reference to the current directory of
+// p's thread group, which another thread may change.
+struct inode*
+cwdget(struct proc *p)
+{
+  struct proc *g = p->group;
+  struct inode *ip;
+
+  acquire(&g->lock);
+  ip = idup(g->cwd);
+  release(&g->lock);
+  return ip;
+}
+
+// Take a process that may run on c from the other CPUs'
+// run queues, trying the longest first, or 0 if there's none.
+static struct proc*
+runqsteal(struct cpu *c)
+{
+  struct cpu *c1, *victim;
+  struct proc *p;
+
+  // a racy look, to avoid taking every CPU's lock.
+  victim = 0;
+  for(c1 = cpus; c1 < &cpus[NCPU]; c1++){
+    if(c1 != c && c1->nrunnable > 0 &&
+       (victim == 0 || c1->nrunnable > victim->nrunnable))
+      victim = c1;
+  }
+  if(victim == 0)
+    return 0;
+  if((p = runqget(victim, c)) != 0)
+    return p;
+  for(c1 = cpus; c1 < &cpus[NCPU]; c1++){
+    if(c1 != c && c1 != victim && c1->nrunnable > 0 &&
+       (p = runqget(c1, c)) != 0)
+      return p;
+  }
+  return 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from this CPU's run queue
+//    or, if that's empty, from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -460,33 +1285,60 @@ scheduler(void)
   struct cpu *c = mycpu();
   
   c->proc = 0;
+  __sync_fetch_and_or(&onlinecpus, CPUMASK(c));
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
-    
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
 
-        found = 1;
+    if((p = runqget(c, c)) == 0 && (p = runqsteal(c)) == 0){
+      // park until an interrupt, with no clock ticks.
+      // setrunnable() interrupts an idle CPU, so look
+      // at the queues again after saying this one is;
+      // wfi returns for a pending interrupt even with
+      // interrupts off, so none can be missed.
+      intr_off();
+      c->idle = 1;
+      __sync_synchronize();
+      if((p = runqget(c, c)) == 0 && (p = runqsteal(c)) == 0){
+        timeridle(1);
+        asm volatile("wfi");
+        timeridle(0);
       }
-      release(&p->lock);
-    }
-    if(found == 0) {
+      c->idle = 0;
       intr_on();
-      asm volatile("wfi");
+      if(p == 0)
+        continue;
+    }
+
+    // p may have yielded on another CPU that hasn't
+    // switched away from it yet; it holds p->lock
+    // until it has.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    if((p->affinity & CPUMASK(c)) == 0){
+      // sched_setaffinity() moved it off this CPU.
+      setrunnable(p);
+      release(&p->lock);
+      continue;
     }
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = cpuid();
+    p->tstamp = r_time();
+    p->ru.wtime += p->tstamp - p->readyat;
+    c->proc = p;
+    kvmswitch(p);
+    swtch(&c->context, &p->context);
+    kvmswitch(0);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -512,6 +1364,7 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
+  p->ru.stime += r_time() - p->tstamp;
   intena = mycpu()->intena;
   swtch(&p->context, &mycpu()->context);
   mycpu()->intena = intena;
@@ -523,7 +1376,8 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  p->ru.nivcsw++;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -555,25 +1409,43 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *q = WAITQ(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Once we hold p->lock and are on chan's
+  // wait queue, we can be guaranteed that we
+  // won't miss any wakeup (wakeup looks at the
+  // queue, then locks p->lock),
   // so it's okay to release lk.
-  if(lk != &p->lock){  //DOC: sleeplock0
+  if(lk != &p->lock)  //DOC: sleeplock0
     acquire(&p->lock);  //DOC: sleeplock1
+  p->chan = chan;
+  acquire(&q->lock);
+  p->wqprev = 0;
+  p->wqnext = q->head;
+  if(q->head)
+    q->head->wqprev = p;
+  q->head = p;
+  release(&q->lock);
+  if(lk != &p->lock)
     release(lk);
-  }
 
   // Go to sleep.
-  p->chan = chan;
   p->state = SLEEPING;
+  p->ru.nvcsw++;
 
   sched();
 
   // Tidy up.
+  acquire(&q->lock);
+  if(p->wqprev)
+    p->wqprev->wqnext = p->wqnext;
+  else
+    q->head = p->wqnext;
+  if(p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  release(&q->lock);
   p->chan = 0;
 
   // Reacquire original lock.
@@ -588,15 +1460,77 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeupn(chan, NPROC);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+// Wake up at most n of the processes sleeping on chan,
+// those that went to sleep first, for futexwake().
+// Returns how many were woken.
+// Must be called without any p->lock.
+int
+wakeupn(void *chan, int n)
+{
+  struct proc *p, *waiters[NPROC];
+  struct waitq *q = WAITQ(chan);
+  int i, nw, woken;
+
+  // a process's chan can't change while it's on the
+  // queue. sleep() takes p->lock before q->lock, so
+  // collect the waiters before taking their locks.
+  // sleep() adds them at the head of the queue.
+  nw = 0;
+  acquire(&q->lock);
+  for(p = q->head; p; p = p->wqnext){
+    if(p->chan == chan)
+      waiters[nw++] = p;
+  }
+  release(&q->lock);
+
+  woken = 0;
+  for(i = nw - 1; i >= 0 && woken < n; i--){
+    p = waiters[i];
     acquire(&p->lock);
     if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+      setrunnable(p);
+      woken++;
     }
     release(&p->lock);
   }
+  __sync_fetch_and_add(&nwakeup, 1);
+  __sync_fetch_and_add(&nexamined, nw);
+  return woken;
+}
+
+// Copy out the resource usage of the current process, or of
+// the children it has waited for, to user address addr.
+// Returns 0, or -1 if who or addr is bad.
+int
+getrusage(int who, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct rusage ru;
+
+  if(who == RUSAGE_SELF){
+    ru = p->ru;
+    ru.stime += r_time() - p->tstamp; // this system call so far
+  } else if(who == RUSAGE_CHILDREN){
+    ru = p->cru;
+  } else {
+    return -1;
+  }
+  return copyout(p->pagetable, addr, (char *)&ru, sizeof(ru));
+}
+
+// Report wakeup()'s work, the interrupts sent to idle
+// CPUs, and TLB shootdowns, for the statistics device.
+int
+procstats(char *buf, int sz)
+{
+  return snprintf(buf, sz, "wakeup: %d calls, %d procs examined, %d without wait queues\n"
+                  "ipi: %d sent to idle cpus\n"
+                  "tlb: %d shootdowns, %d ipis\n",
+                  nwakeup, nexamined, nwakeup * NPROC, nipi,
+                  nshootdown, ntlbipi);
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -607,7 +1541,7 @@ wakeup1(struct proc *p)
   if(!holding(&p->lock))
     panic("wakeup1");
   if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+    setrunnable(p);
   }
 }
 
@@ -625,7 +1559,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -673,6 +1607,7 @@ procdump(void)
 {
   static char *states[] = {
   [UNUSED]    "unused",
+  [USED]      "used  ",
   [SLEEPING]  "sleep ",
   [RUNNABLE]  "runble",
   [RUNNING]   "run   ",
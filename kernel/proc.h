@@ -24,6 +24,15 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint asidgen;               // ASID generation of this hart's TLB; see vm.c
+  struct spinlock rqlock;     // protects the run queues
+  struct proc *rqhead[NPRIO]; // run queue of RUNNABLE processes, by priority
+  struct proc *rqtail[NPRIO];
+  int nrunnable;              // length of the run queues
+  uint boostgen;              // last priority boost applied to the queues
+  int idle;                   // parked in scheduler() until an interrupt
+  uint tlbreq;                // TLB flushes asked for by tlbshootdown()
+  uint tlbdone;               // the last one done; see tlbpoll()
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,7 +89,23 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+
+// A region of a file mapped by mmap(), or a
+// program segment loaded lazily by exec().
+struct vma {
+  uint64 addr;                 // Start, page-aligned
+  uint64 len;                  // Length in bytes; 0 if unused
+  int prot;                    // PROT_READ &c
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, VMA_EXEC
+  struct inode *ip;            // Mapped file, or 0
+  uint64 off;                  // File offset of addr
+  uint64 filesz;               // Bytes from the file; the rest are zero
+};
+
+#define VMA_EXEC 0x100         // program segment, below p->sz
+#define VMA_STACK 0x200        // the user stack, with no file
+#define VMA_UNMAP 0x400        // being unmapped; see munmap()
 
 // Per-process state
 struct proc {
@@ -93,14 +118,45 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int asid;                    // Address-space ID of kpagetable; see kvmswitch()
+  int uasid;                   // and of pagetable
+  uint asidgen;                // Generation of asid, 0 if none yet
+  int tlbcpu;                  // Hart that last ran p, -1 if TLBs may be stale
+  int cpu;                     // CPU whose run queue p goes on
+  int nice;                    // Highest priority p may have; see setpriority()
+  int affinity;                // Mask of CPUs p may run on; see setaffinity()
+  int prio;                    // Priority level, 0 highest
+  int slice;                   // Ticks used at prio
+  uint boostgen;               // Last priority boost applied to p
+  struct proc *rqnext;         // Next on the run queue
+  struct proc *wqnext;         // Next on chan's wait queue; see sleep()
+  struct proc *wqprev;
+  uint64 readyat;              // When p last became RUNNABLE
 
   // these are private to the process, so p->lock need not be held.
+  struct proc *group;          // Thread group leader, p if not a thread; see clone()
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, also maps user memory
+  int ucopy;                   // In copyin/copyout; kerneltrap() handles faults
+  int ucopyerr;                // A user access in copyin/copyout failed
+  int inkernel;                // In a system call or page fault; see swap.c
+  struct rusage ru;            // CPU time and such, for getrusage()
+  struct rusage cru;           // Totals for children waited for
+  uint64 tstamp;               // When p entered or left user space or a CPU
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
+  char name[16];               // Process name (debugging)
+
+  // these are shared by the threads of a group, and only used
+  // in the leader. vmlock() must be held to change sz or vma[];
+  // the leader's lock protects ofile[] and cwd.
+  struct spinlock vmlk;        // protects vmbusy, vmfaulting
+  int vmbusy;                  // address space locked; see vmlock()
+  int vmfaulting;              // faults reading files; see vmafault()
+  int nthread;                 // Threads that haven't exited, with the leader
+  uint64 sz;                   // Size of process memory (bytes)
+  struct vma vma[NVMA];        // mmap()ed files
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
-  char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,12 @@
+#define RUSAGE_SELF     0  // the calling process
+#define RUSAGE_CHILDREN 1  // its children that it has waited for
+
+// times are in cycles of the timer; see MSCYCLES in param.h.
+struct rusage {
+  uint64 utime;   // running in user space
+  uint64 stime;   // running in the kernel
+  uint64 wtime;   // runnable, waiting for a CPU
+  int nvcsw;      // voluntary context switches: sleeps
+  int nivcsw;     // involuntary ones: time slices used up
+  int nfault;     // page faults
+};
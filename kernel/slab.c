@@ -0,0 +1,203 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of one fixed size, carved
+// from slabs of 2^order contiguous pages obtained from
+// kalloc_pages(). Each slab starts with a struct slab
+// header followed by its objects; free objects are
+// linked through their first word. Since kalloc_pages()
+// blocks are aligned to their size, an object's slab is
+// found by rounding its address down.
+//
+// Each CPU has a small magazine of free objects for each
+// cache, used with interrupts off and no lock, so most
+// allocations and frees never touch the cache lock.
+// An empty magazine refills, and a full one flushes,
+// half a magazine at a time under the cache lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE   8    // maximum number of caches
+#define MAGSIZE  16   // objects per per-CPU magazine
+#define MINOBJS  8    // grow the slab order until a slab holds this many
+
+struct slab {
+  struct slab *next;         // on the cache's partial list
+  struct slab *prev;
+  void *free;                // free objects in this slab
+  int inuse;                 // objects allocated, including in magazines
+};
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;                 // object size, rounded up to 8 bytes
+  int order;                 // each slab is 2^order pages
+  int perslab;               // objects per slab
+  struct spinlock lock;
+  struct slab partial;       // slabs with some free objects
+  struct slab *spare;        // one completely free slab kept around
+  struct magazine mag[NCPU];
+};
+
+static struct kmem_cache caches[NCACHE];
+static int ncache;
+
+#define SLABHDR  ((sizeof(struct slab) + 7) & ~7L)
+
+// Create a cache of objects of the given size.
+// Only called during boot, before other CPUs start.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  if(ncache >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &caches[ncache++];
+
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  for(c->order = 0; ; c->order++){
+    c->perslab = ((PGSIZE << c->order) - SLABHDR) / c->size;
+    if(c->perslab >= MINOBJS || c->order == 3)
+      break;
+  }
+  if(c->perslab < 1)
+    panic("kmem_cache_create: object too big");
+  initlock(&c->lock, name);
+  c->partial.next = c->partial.prev = &c->partial;
+  return c;
+}
+
+// Get a new slab from kalloc_pages() and put it on the
+// partial list. Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = c->spare) != 0){
+    c->spare = 0;
+  } else {
+    if((s = kalloc_pages(c->order)) == 0)
+      return 0;
+    s->free = 0;
+    obj = (char*)s + SLABHDR;
+    for(int i = 0; i < c->perslab; i++, obj += c->size){
+      *(void**)obj = s->free;
+      s->free = obj;
+    }
+    s->inuse = 0;
+  }
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+  return s;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+// Move up to n objects from the slabs into magazine m.
+// Caller must hold c->lock.
+static void
+mag_refill(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(n-- > 0){
+    s = c->partial.next;
+    if(s == &c->partial && (s = slab_grow(c)) == 0)
+      break;
+    obj = s->free;
+    s->free = *(void**)obj;
+    s->inuse++;
+    if(s->free == 0)
+      slab_unlink(s);  // now full
+    m->obj[m->n++] = obj;
+  }
+}
+
+// Return n objects from magazine m to their slabs.
+// Caller must hold c->lock.
+static void
+mag_flush(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(n-- > 0 && m->n > 0){
+    obj = m->obj[--m->n];
+    s = (struct slab*)((uint64)obj & ~((PGSIZE << c->order) - 1));
+    if(s->free == 0){
+      // was full; make it allocatable again.
+      s->next = c->partial.next;
+      s->prev = &c->partial;
+      c->partial.next->prev = s;
+      c->partial.next = s;
+    }
+    *(void**)obj = s->free;
+    s->free = obj;
+    if(--s->inuse == 0){
+      slab_unlink(s);
+      if(c->spare == 0)
+        c->spare = s;
+      else
+        kfree_pages(s, c->order);
+    }
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    mag_refill(c, m, MAGSIZE/2);
+    release(&c->lock);
+  }
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  pop_off();
+  return obj;
+}
+
+// Return an object to cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    mag_flush(c, m, MAGSIZE/2);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+}
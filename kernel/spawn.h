@@ -0,0 +1,14 @@
+// File actions for spawn(). The child starts with the
+// parent's open files, then the actions are applied in
+// order. The array ends with an action whose op is 0.
+struct spawnact {
+  int op;          // SPAWN_OPEN, SPAWN_DUP2 or SPAWN_CLOSE
+  int fd;          // descriptor acted on
+  int newfd;       // SPAWN_DUP2: make newfd a copy of fd
+  int mode;        // SPAWN_OPEN: open() mode
+  char *path;      // SPAWN_OPEN: file to open as fd
+};
+
+#define SPAWN_OPEN  1
+#define SPAWN_DUP2  2
+#define SPAWN_CLOSE 3
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -29,8 +30,10 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
+  // the holder may be waiting for this hart to flush its
+  // TLB, in tlbshootdown().
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    tlbpoll();
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -0,0 +1,100 @@
+//
+// formatted output to a buffer -- snprintf.
+//
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+// Put c at buf[off] if there is room.
+// Returns the new offset.
+static int
+sputc(char *buf, int sz, int off, char c)
+{
+  if(off < sz)
+    buf[off++] = c;
+  return off;
+}
+
+static int
+sprintint(char *buf, int sz, int off, int xx, int base, int sign)
+{
+  char tmp[16];
+  int i;
+  uint x;
+
+  if(sign && (sign = xx < 0))
+    x = -xx;
+  else
+    x = xx;
+
+  i = 0;
+  do {
+    tmp[i++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(sign)
+    tmp[i++] = '-';
+
+  while(--i >= 0)
+    off = sputc(buf, sz, off, tmp[i]);
+  return off;
+}
+
+// Format into buf, writing at most sz bytes, without a
+// terminating 0. Understands only %d, %x, %s.
+// Returns the number of bytes written.
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int i, c, off = 0;
+  char *s;
+
+  if(fmt == 0)
+    panic("null fmt");
+
+  va_start(ap, fmt);
+  for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
+    if(c != '%'){
+      off = sputc(buf, sz, off, c);
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    if(c == 0)
+      break;
+    switch(c){
+    case 'd':
+      off = sprintint(buf, sz, off, va_arg(ap, int), 10, 1);
+      break;
+    case 'x':
+      off = sprintint(buf, sz, off, va_arg(ap, int), 16, 0);
+      break;
+    case 's':
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      for(; *s; s++)
+        off = sputc(buf, sz, off, *s);
+      break;
+    case '%':
+      off = sputc(buf, sz, off, '%');
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      off = sputc(buf, sz, off, '%');
+      off = sputc(buf, sz, off, c);
+      break;
+    }
+  }
+  va_end(ap);
+  return off;
+}
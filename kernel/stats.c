@@ -0,0 +1,70 @@
+//
+// The statistics device: reading it returns a text report
+// of the kernel's counters, which each subsystem formats.
+// Each open-and-read-to-the-end sees a fresh snapshot.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define BUFSZ 4096
+
+static struct {
+  struct sleeplock lock;  // held across the copy, which may sleep
+  char buf[BUFSZ];
+  int sz;       // bytes in buf
+  int off;      // bytes already read
+} stats;
+
+int
+statswrite(int user_src, uint64 src, int n)
+{
+  return -1;
+}
+
+// Copy up to n bytes of the report to dst. Returns 0 at
+// the end of the report, after which the next read starts
+// a new one.
+int
+statsread(int user_dst, uint64 dst, int n)
+{
+  int m;
+
+  acquiresleep(&stats.lock);
+
+  if(stats.sz == 0){
+    stats.sz = vmstats(stats.buf, BUFSZ);
+    stats.sz += procstats(stats.buf + stats.sz, BUFSZ - stats.sz);
+  }
+  m = stats.sz - stats.off;
+
+  if(m > 0){
+    if(m > n)
+      m = n;
+    if(either_copyout(user_dst, dst, stats.buf+stats.off, m) != -1)
+      stats.off += m;
+    else
+      m = -1;
+  } else {
+    m = 0;
+    stats.sz = 0;
+    stats.off = 0;
+  }
+  releasesleep(&stats.lock);
+  return m;
+}
+
+void
+statsinit(void)
+{
+  initsleeplock(&stats.lock, "stats");
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
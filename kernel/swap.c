@@ -0,0 +1,268 @@
+//
+// Swapping of user pages to the swap area that mkfs
+// reserves on the disk after the file system.
+//
+// kalloc_user() allocates pages of user memory. When
+// kalloc() has none left, swapout() picks a victim with a
+// clock algorithm over processes' user pages: a page whose
+// PTE_A bit the hardware has set since the clock hand last
+// passed loses the bit and gets another chance. The victim
+// is written to a free slot of the swap area, and its PTE is
+// replaced by one with PTE_SWAP set and the slot number in
+// place of the physical page number. A page fault on that
+// PTE reads the page back in with swapin().
+//
+// Only pages below p->sz that belong to a single page table
+// are swapped out, so never pages of mmap()ed files or
+// pages shared with a parent or child by copy-on-write fork,
+// nor those of a process with threads, which other harts
+// could be using.
+// Another process's pages are only taken while it is
+// runnable in user space, not while a system call may be
+// using its page table.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+
+// a swapped-out page's PTE holds its slot in place of the PPN.
+#define SLOT2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SLOT(pte) ((pte) >> 10)
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;
+  uint start;           // first block of the swap area
+  int nslot;            // 0 if there's no swap area
+  short ref[NSWAP];     // number of PTEs that refer to each slot
+  char busy[NSWAP];     // being written by swapout()
+  int nused;            // slots in use
+  int hand;             // the clock: next process to look at,
+  uint64 handva;        // and the next address in it
+} swap;
+
+// Called by fsinit() with the file system's superblock.
+void
+swapinit(struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap < NSWAP ? sb->nswap : NSWAP;
+}
+
+// Add a reference to the slot of the swapped-out page
+// whose PTE is pte, for fork().
+void
+swapdup(pte_t pte)
+{
+  acquire(&swap.lock);
+  swap.ref[PTE2SLOT(pte)]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to the slot of the swapped-out page
+// whose PTE is pte; the slot is free when none are left.
+void
+swapfree(pte_t pte)
+{
+  int slot = PTE2SLOT(pte);
+
+  acquire(&swap.lock);
+  if(--swap.ref[slot] < 0)
+    panic("swapfree");
+  if(swap.ref[slot] == 0 && !swap.busy[slot])
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Find a page of p to swap out, starting at *va, and
+// clearing the PTE_A bits of the pages passed over.
+// Returns its PTE, with *va set to its address, or 0
+// if the clock reached the end of p's memory.
+static pte_t*
+swapvictim(struct proc *p, uint64 *va)
+{
+  pte_t *pte;
+  uint64 a;
+
+  for(a = *va; a < p->sz; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    if(krefcount((void*)PTE2PA(*pte)) != 1)
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    *va = a;
+    return pte;
+  }
+  return 0;
+}
+
+// Write a user page to the swap area and free it.
+// Returns 1 if a page was freed, 0 if none could be.
+static int
+swapout(void)
+{
+  struct proc *p, *me = myproc();
+  uint64 va, pa;
+  pte_t *pte = 0;
+  int n, slot;
+
+  // visit each process twice, to get past
+  // the PTE_A bits cleared on the first visit.
+  for(n = 0; n < 2*NPROC; n++){
+    acquire(&swap.lock);
+    p = &proc[swap.hand];
+    va = swap.handva;
+    release(&swap.lock);
+
+    if(p != me)
+      acquire(&p->lock);
+    if((p == me || (p->state == RUNNABLE && !p->inkernel)) &&
+       p->group->nthread == 1)
+      pte = swapvictim(p, &va);
+    if(p == me)
+      sfence_vma(); // for the PTE_A bits.
+    if(pte)
+      break;
+    if(p != me)
+      release(&p->lock);
+
+    acquire(&swap.lock);
+    if(&proc[swap.hand] == p){
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.handva = 0;
+    }
+    release(&swap.lock);
+  }
+  if(pte == 0)
+    return 0;
+
+  acquire(&swap.lock);
+  for(slot = 0; slot < swap.nslot; slot++){
+    if(swap.ref[slot] == 0 && !swap.busy[slot])
+      break;
+  }
+  if(slot == swap.nslot){
+    release(&swap.lock);
+    if(p != me)
+      release(&p->lock);
+    return 0;
+  }
+  swap.ref[slot] = 1;
+  swap.busy[slot] = 1;
+  swap.nused++;
+  swap.hand = p - proc;
+  swap.handva = va + PGSIZE;
+  release(&swap.lock);
+
+  // p can't run while we hold its lock, and the scheduler
+  // flushes its TLB entries before it does.
+  pa = PTE2PA(*pte);
+  *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SWAP;
+  if(p == me){
+    sfence_vma();
+  } else {
+    p->tlbcpu = -1;
+    release(&p->lock);
+  }
+
+  // a fault on the page waits in swapin() until
+  // the write is done.
+  virtio_disk_rwpage(swap.start + slot*BPP, (void*)pa, 1);
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  if(swap.ref[slot] == 0)
+    swap.nused--;
+  wakeup(&swap.busy[slot]);
+  release(&swap.lock);
+  kfree((void*)pa);
+  return 1;
+}
+
+// Read the swapped-out page at va in pagetable back in.
+// Returns 0 on success, -1 if out of memory or the
+// caller holds a spinlock, so can't sleep for the disk.
+int
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte, old;
+  char *mem;
+  int slot;
+
+  if(mycpu()->noff > 0)
+    return -1;
+  if((mem = kalloc_user()) == 0)
+    return -1;
+
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_SWAP) == 0){
+    // brought in while kalloc_user() slept.
+    kfree(mem);
+    return 0;
+  }
+  old = *pte;
+  slot = PTE2SLOT(old);
+
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  release(&swap.lock);
+
+  virtio_disk_rwpage(swap.start + slot*BPP, mem, 0);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_V | PTE_A;
+  swapfree(old);
+  return 0;
+}
+
+// Allocate a page for user memory, swapping another
+// page out if memory has run out, which sleeps; a caller
+// that holds a spinlock just gets kalloc().
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_user(void)
+{
+  void *mem;
+
+  while((mem = kalloc()) == 0){
+    if(swap.nslot == 0 || myproc() == 0 || mycpu()->noff > 0)
+      return 0;
+    if(swapout() == 0)
+      return 0;
+  }
+  return mem;
+}
+
+// Make sure that n pages are free, if memory is short
+// enough that pages are being swapped out, for a caller
+// about to allocate them while holding a spinlock, when
+// kalloc_user() can't swap. Other CPUs may take the
+// pages first, so this is only a hint.
+void
+swapreserve(int n)
+{
+  char *pa, *head = 0;
+
+  if(swap.nused == 0)
+    return;
+  while(n-- > 0 && (pa = kalloc_user()) != 0){
+    *(char**)pa = head;
+    head = pa;
+  }
+  while(head){
+    pa = head;
+    head = *(char**)pa;
+    kfree(pa);
+  }
+}
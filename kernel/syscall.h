@@ -20,3 +20,16 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_mmap   22
+#define SYS_munmap 23
+#define SYS_spawn  24
+#define SYS_setpriority 25
+#define SYS_msleep 26
+#define SYS_getrusage 27
+#define SYS_waitru 28
+#define SYS_sched_setaffinity 29
+#define SYS_sched_getaffinity 30
+#define SYS_clone  31
+#define SYS_join   32
+#define SYS_futex_wait 33
+#define SYS_futex_wake 34
@@ -10,28 +10,36 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return the corresponding struct file, with a reference
+// of its own, which the caller must fileclose(): another thread
+// could close the descriptor meanwhile.
 static int
-argfd(int n, int *pfd, struct file **pf)
+argfd(int n, struct file **pf)
 {
   int fd;
-  struct file *f;
+  struct file *f = 0;
+  struct proc *g = myproc()->group;
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&g->lock);
+  if((f = g->ofile[fd]) != 0)
+    filedup(f);
+  release(&g->lock);
+  if(f == 0)
     return -1;
-  if(pfd)
-    *pfd = fd;
-  if(pf)
-    *pf = f;
+  *pf = f;
   return 0;
 }
 
@@ -41,28 +49,49 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct proc *g = myproc()->group;
 
+  acquire(&g->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(g->ofile[fd] == 0){
+      g->ofile[fd] = f;
+      release(&g->lock);
       return fd;
     }
   }
+  release(&g->lock);
   return -1;
 }
 
+// Remove descriptor fd, and return its file, whose
+// reference passes to the caller, or 0 if it's not open.
+static struct file*
+fdremove(int fd)
+{
+  struct file *f;
+  struct proc *g = myproc()->group;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&g->lock);
+  f = g->ofile[fd];
+  g->ofile[fd] = 0;
+  release(&g->lock);
+  return f;
+}
+
 uint64
 sys_dup(void)
 {
   struct file *f;
   int fd;
 
-  if(argfd(0, 0, &f) < 0)
+  if(argfd(0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -70,25 +99,29 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, &f) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
@@ -97,9 +130,8 @@ sys_close(void)
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(0, &fd) < 0 || (f = fdremove(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -109,10 +141,13 @@ sys_fstat(void)
 {
   struct file *f;
   uint64 st; // user pointer to struct stat
+  int r;
 
-  if(argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
+  if(argaddr(1, &st) < 0 || argfd(0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -257,9 +292,16 @@ create(char *path, short type, short major, short minor)
     iunlockput(ip);
     return 0;
   }
+  if(dirinum(dp, name, 0) != 0){
+    // it exists, but there was no memory for its inode.
+    iunlockput(dp);
+    return 0;
+  }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -283,17 +325,13 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-uint64
-sys_open(void)
+// Open path with omode, for open() and spawn().
+// Returns the new file, or 0.
+static struct file*
+openfile(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op();
 
@@ -301,33 +339,38 @@ sys_open(void)
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((omode & O_TRUNC) && ip->ntext > 0){
+    // text of a running program; see idenywrite().
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
+  }
+
+  if((f = filealloc()) == 0){
+    iunlockput(ip);
+    end_op();
+    return 0;
   }
 
   if(ip->type == T_DEVICE){
@@ -348,6 +391,24 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  return f;
+}
+
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int fd, omode;
+  struct file *f;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  if((f = openfile(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -391,8 +452,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct proc *g = myproc()->group;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -406,29 +467,31 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&g->lock);
+  old = g->cwd;
+  g->cwd = ip;
+  release(&g->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Copy the user argument vector at uargv into argv[MAXARG],
+// one page per string. Returns 0 on success, -1 on failure;
+// either way, the caller must freeargv(argv).
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -436,22 +499,136 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
+static void
+freeargv(char **argv)
+{
+  int i;
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0){
+    freeargv(argv);
+    return -1;
+  }
+
+  ret = exec(myproc(), path, argv);
 
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// Apply the spawn() file action at user address uact to
+// ofile[], the new process's open files.
+// Returns 1 if it was the terminating action, 0 if it was
+// applied, -1 if it's bad.
+static int
+applyact(uint64 uact, struct file **ofile)
+{
+  struct proc *p = myproc();
+  struct spawnact act;
+  char path[MAXPATH];
+  struct file *f;
+
+  if(copyin(p->pagetable, (char*)&act, uact, sizeof(act)) < 0)
+    return -1;
+  if(act.op == 0)
+    return 1;
+  if(act.fd < 0 || act.fd >= NOFILE)
+    return -1;
+
+  switch(act.op){
+  case SPAWN_OPEN:
+    if(fetchstr((uint64)act.path, path, MAXPATH) < 0)
+      return -1;
+    if((f = openfile(path, act.mode)) == 0)
+      return -1;
+    if(ofile[act.fd])
+      fileclose(ofile[act.fd]);
+    ofile[act.fd] = f;
+    break;
+  case SPAWN_DUP2:
+    if(act.newfd < 0 || act.newfd >= NOFILE || ofile[act.fd] == 0)
+      return -1;
+    f = filedup(ofile[act.fd]);
+    if(ofile[act.newfd])
+      fileclose(ofile[act.newfd]);
+    ofile[act.newfd] = f;
+    break;
+  case SPAWN_CLOSE:
+    if(ofile[act.fd]){
+      fileclose(ofile[act.fd]);
+      ofile[act.fd] = 0;
+    }
+    break;
+  default:
+    return -1;
+  }
+  return 0;
+}
+
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct file *ofile[NOFILE];
+  struct proc *g = myproc()->group;
+  uint64 uargv, uacts;
+  int i, r, pid;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &uacts) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0){
+    freeargv(argv);
+    return -1;
+  }
+
+  // the child's open files: the parent's, then the actions.
+  acquire(&g->lock);
+  for(i = 0; i < NOFILE; i++){
+    ofile[i] = g->ofile[i];
+    if(ofile[i])
+      filedup(ofile[i]);
+  }
+  release(&g->lock);
+  r = 0;
+  for(i = 0; uacts != 0 && r == 0; i++){
+    if(i >= 2*NOFILE)
+      r = -1;
+    else
+      r = applyact(uacts + i*sizeof(struct spawnact), ofile);
+  }
+  if(r < 0){
+    for(i = 0; i < NOFILE; i++)
+      if(ofile[i])
+        fileclose(ofile[i]);
+    freeargv(argv);
+    return -1;
+  }
+
+  pid = spawn(path, argv, ofile);
+
+  freeargv(argv);
+  return pid;
 }
 
 uint64
@@ -469,18 +646,43 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdremove(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdremove(fd0);
+    fdremove(fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len, off, r;
+  int prot, flags;
+  struct file *f;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argaddr(5, &off) < 0 || argfd(4, &f) < 0)
+    return -1;
+  r = mmap(addr, len, prot, flags, f, off);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
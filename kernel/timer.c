@@ -0,0 +1,194 @@
+//
+// Timers: sleeping until a deadline, and the clock tick.
+//
+// Each CPU has a timer wheel of the deadlines of processes
+// that went to sleep on it, in cycles of the CLINT's mtime
+// register. A deadline goes in slot (deadline / WHEELRES) %
+// NWHEEL, so a timer interrupt only looks at the slots that
+// time has passed through since the last one, and wakes only
+// the processes whose deadlines are up.
+//
+// The CPU's mtimecmp register holds the earlier of its next
+// clock tick and the first deadline on its wheel, so a sleep
+// can end between ticks. The interrupt arrives in machine
+// mode at timervec in kernelvec.S, which turns the timer off
+// and raises a software interrupt; devintr() in trap.c then
+// calls timerintr(), which sets the next deadline.
+//
+// A CPU with nothing to run has no clock ticks: the scheduler
+// calls timeridle(), and its timer is only set for deadlines.
+// Since the CPUs' ticks aren't in step, and idle CPUs skip
+// theirs, ticks counts time from the CLINT, not interrupts.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+#define WHEELRES MSCYCLES   // cycles per slot of a wheel
+#define NWHEEL   128        // slots per wheel; more than a tick's worth
+
+#define SLOT(t) (((t) / WHEELRES) % NWHEEL)
+#define MTIME (*(volatile uint64*)KCLINT_MTIME)
+#define MTIMECMP(hart) (*(volatile uint64*)KCLINT_MTIMECMP(hart))
+
+// a sleeping process's entry in a wheel,
+// on the process's kernel stack.
+struct timer {
+  uint64 deadline;
+  int done;                  // deadline passed and off the wheel
+  struct timer *next;
+};
+
+struct wheel {
+  struct spinlock lock;
+  struct timer *slot[NWHEEL];
+  uint64 last;               // when the slots were last looked at
+  uint64 nexttick;           // when the CPU's next clock tick is due
+  uint64 cmp;                // what the CPU's mtimecmp was set to
+  int idle;                  // no clock ticks; see timeridle()
+} wheels[NCPU];
+
+// Set this CPU's timer for the earlier of its next clock tick,
+// unless it's idle, and the first deadline on its wheel.
+// Caller holds w->lock, for w this CPU's wheel.
+static void
+timerset(struct wheel *w)
+{
+  struct timer *t;
+  uint64 a, next = w->idle ? -1 : w->nexttick;
+  int i;
+
+  // every deadline is after w->last, so one before next is
+  // in one of the slots from w->last to next. look at each
+  // slot at most once.
+  for(a = w->last, i = 0; i < NWHEEL && a/WHEELRES <= next/WHEELRES;
+      a += WHEELRES, i++){
+    for(t = w->slot[SLOT(a)]; t; t = t->next){
+      if(t->deadline < next)
+        next = t->deadline;
+    }
+  }
+  w->cmp = next;
+  MTIMECMP(cpuid()) = next;
+}
+
+// Start this CPU's clock ticks, with its wheel empty.
+void
+timerinithart(void)
+{
+  struct wheel *w = &wheels[cpuid()];
+
+  initlock(&w->lock, "wheel");
+  acquire(&w->lock);
+  w->last = MTIME;
+  w->nexttick = w->last + TICKCYCLES;
+  timerset(w);
+  release(&w->lock);
+}
+
+// Called by devintr() for this CPU's timer: wake the processes
+// whose deadlines have passed, and set the timer for the next.
+// Returns 1 if a clock tick is due, 0 if the interrupt was
+// only for a deadline.
+int
+timerintr(void)
+{
+  struct wheel *w = &wheels[cpuid()];
+  struct timer *t, **tp;
+  uint64 now, a;
+  int tick = 0;
+
+  acquire(&w->lock);
+  now = MTIME;
+  if(!w->idle && now >= w->nexttick){
+    tick = 1;
+    w->nexttick += TICKCYCLES;
+    if(w->nexttick <= now)
+      w->nexttick = now + TICKCYCLES; // missed some.
+  }
+
+  // look at each slot passed since last time, at most once.
+  for(a = w->last; a/WHEELRES <= now/WHEELRES && a - w->last < NWHEEL*WHEELRES;
+      a += WHEELRES){
+    for(tp = &w->slot[SLOT(a)]; (t = *tp) != 0; ){
+      if(t->deadline <= now){
+        *tp = t->next;
+        t->done = 1;
+        wakeup(t);
+      } else {
+        tp = &t->next;
+      }
+    }
+  }
+  w->last = now;
+  timerset(w);
+  release(&w->lock);
+  return tick;
+}
+
+// Stop this CPU's clock ticks while it's idle, or start them
+// again. Ticks missed while idle don't count, but if one was
+// due, it's taken right away.
+void
+timeridle(int idle)
+{
+  struct wheel *w = &wheels[cpuid()];
+
+  acquire(&w->lock);
+  w->idle = idle;
+  timerset(w);
+  release(&w->lock);
+}
+
+// The number of clock ticks since boot.
+uint
+timerticks(void)
+{
+  return MTIME / TICKCYCLES;
+}
+
+// Sleep for n cycles of the CLINT's clock.
+// Returns 0, or -1 if the process is killed first.
+int
+timersleep(uint64 n)
+{
+  struct wheel *w;
+  struct timer t, **tp;
+
+  if(n == 0)
+    return 0;
+  t.deadline = MTIME + n;
+  t.done = 0;
+
+  // acquire() turns interrupts off, so this stays on
+  // the CPU whose wheel it is until the timer is set.
+  push_off();
+  w = &wheels[cpuid()];
+  acquire(&w->lock);
+  pop_off();
+  t.next = w->slot[SLOT(t.deadline)];
+  w->slot[SLOT(t.deadline)] = &t;
+  if(t.deadline < w->cmp){
+    w->cmp = t.deadline;
+    MTIMECMP(cpuid()) = t.deadline;
+  }
+
+  while(!t.done){
+    if(myproc()->killed){
+      for(tp = &w->slot[SLOT(t.deadline)]; *tp != &t; tp = &(*tp)->next)
+        ;
+      *tp = t.next;
+      release(&w->lock);
+      return -1;
+    }
+    sleep(&t, &w->lock);
+  }
+  release(&w->lock);
+  return 0;
+}
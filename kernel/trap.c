@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -46,6 +47,12 @@ usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+  p->inkernel = 1;
+
+  // the time since usertrapret() was spent in user space.
+  uint64 now = r_time();
+  p->ru.utime += now - p->tstamp;
+  p->tstamp = now;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -67,6 +74,10 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            pagefault(p, r_stval(), r_scause()) == 0){
+    // page fault on a lazily-allocated, mmap()ed, copy-on-write
+    // or swapped-out page.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -76,8 +87,12 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // swapout() may now take p's pages while p waits to run.
+  p->inkernel = 0;
+
+  // give up the CPU if this is a timer interrupt
+  // and the process's time slice is over.
+  if(which_dev == 2 && schedtick())
     yield();
 
   usertrapret();
@@ -96,6 +111,12 @@ usertrapret(void)
   // we're back in user space, where usertrap() is correct.
   intr_off();
 
+  // the time since usertrap(), or since the process last
+  // got a CPU, was spent in the kernel.
+  uint64 now = r_time();
+  p->ru.stime += now - p->tstamp;
+  p->tstamp = now;
+
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
@@ -119,7 +140,7 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->pagetable) | SATP_ASID(p->uasid);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -137,20 +158,30 @@ kerneltrap()
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
   uint64 scause = r_scause();
+  struct proc *p = myproc();
   
   if((sstatus & SSTATUS_SPP) == 0)
     panic("kerneltrap: not from supervisor mode");
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) && p != 0 && p->ucopy && r_stval() < MAXUVA){
+    // copyin_new() &c touched a user page that isn't there
+    // yet, or is copy-on-write. if it can't be faulted in,
+    // fail the copy and step over the faulting instruction.
+    if(pagefault(p, r_stval(), scause) < 0){
+      p->ucopyerr = 1;
+      sepc += (*(ushort*)sepc & 3) == 3 ? 4 : 2;
+    }
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt
+  // and the process's time slice is over.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING && schedtick())
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -159,12 +190,16 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// a clock tick on this CPU. see timer.c for why
+// ticks doesn't just count them.
 void
 clockintr()
 {
+  uint t = timerticks();
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  if(t > ticks)
+    ticks = t;
   release(&tickslock);
 }
 
@@ -202,16 +237,23 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or from another hart's ipi(), forwarded by timervec
+    // in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, before timerintr() sets the
+    // timer again, so that the next one isn't lost.
     w_sip(r_sip() & ~2);
 
+    // another hart may want this one's TLB flushed.
+    tlbpoll();
+
+    // the timer may only have been set for a sleeping
+    // process's deadline; see timer.c.
+    if(timerintr() == 0)
+      return 1;
+
+    clockintr();
     return 2;
   } else {
     return 0;
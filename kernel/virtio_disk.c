@@ -22,10 +22,8 @@
 
 static struct disk {
  // memory for virtio descriptors &c for queue 0.
- // this is a global instead of allocated because it must
- // be multiple contiguous pages, which kalloc()
- // doesn't support, and page aligned.
-  char pages[2*PGSIZE];
+ // two contiguous, page-aligned pages from kalloc_pages().
+  char *pages;
   struct VRingDesc *desc;
   uint16 *avail;
   struct UsedArea *used;
@@ -38,13 +36,13 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    int *busy;     // cleared when the operation is done
     char status;
   } info[NUM];
   
   struct spinlock vdisk_lock;
   
-} __attribute__ ((aligned (PGSIZE))) disk;
+} disk;
 
 void
 virtio_disk_init(void)
@@ -95,7 +93,9 @@ virtio_disk_init(void)
   if(max < NUM)
     panic("virtio disk max queue too short");
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
+  if((disk.pages = kalloc_pages(1)) == 0)
+    panic("virtio disk kalloc");
+  memset(disk.pages, 0, 2*PGSIZE);
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * VRingDesc
@@ -165,11 +165,13 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Read or write len bytes at physical address data from
+// or to the disk at sector, and wait until it's done.
+// busy is cleared by virtio_disk_intr() and is the
+// channel to sleep on.
+static void
+virtio_disk_io(uint64 sector, uint64 data, uint len, int write, int *busy)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
   acquire(&disk.vdisk_lock);
 
   // the spec says that legacy block operations use three
@@ -208,12 +210,12 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
+  disk.desc[idx[1]].addr = data;
+  disk.desc[idx[1]].len = len;
   if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+    disk.desc[idx[1]].flags = 0; // device reads data
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes data
   disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
   disk.desc[idx[1]].next = idx[2];
 
@@ -223,9 +225,9 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
   disk.desc[idx[2]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the busy flag for virtio_disk_intr().
+  *busy = 1;
+  disk.info[idx[0]].busy = busy;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
@@ -238,16 +240,35 @@ virtio_disk_rw(struct buf *b, int write)
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
   // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  while(*busy == 1) {
+    sleep(busy, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
+  disk.info[idx[0]].busy = 0;
   free_chain(idx[0]);
 
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_io(b->blockno * (BSIZE / 512), (uint64) b->data, BSIZE,
+                 write, &b->disk);
+}
+
+// Read or write the page of physical memory at pa from
+// or to the disk, starting at block blockno.
+void
+virtio_disk_rwpage(uint blockno, void *pa, int write)
+{
+  int busy;
+
+  // busy is on the kernel stack, but unlike buf0 only
+  // the kernel, not the device, touches it.
+  virtio_disk_io(blockno * (BSIZE / 512), (uint64) pa, PGSIZE, write, &busy);
+}
+
 void
 virtio_disk_intr()
 {
@@ -259,8 +280,8 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
     
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+    *disk.info[id].busy = 0;   // disk is done with the request
+    wakeup(disk.info[id].busy);
 
     disk.used_idx = (disk.used_idx + 1) % NUM;
   }
@@ -5,6 +5,9 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +18,52 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+/*
+ * a page of zeroes, mapped copy-on-write in place of anonymous
+ * pages that have been read but never written. it keeps one
+ * reference of its own, so it's never freed.
+ */
+static char *zeropage;
+static int nzerofault; // faults that mapped zeropage
+
+/*
+ * user megapages: each has a level-0 page-table page set
+ * aside, so that walk() can split it into 4096-byte pages
+ * without allocating. indexed by physical megapage number.
+ */
+#define NMEGA ((PHYSTOP - KERNBASE) / MEGAPGSIZE)
+static pagetable_t megal0[NMEGA];
+static int nmegafault; // faults that mapped a megapage
+
+/*
+ * the number of PTEs in use (valid or swapped out) in each
+ * page-table page, indexed by physical page number, so that
+ * uvmunmap() can free a page-table page once it's empty.
+ */
+static short ptused[(PHYSTOP - KERNBASE) / PGSIZE];
+#define PTUSED(pt) ptused[((uint64)(pt) - KERNBASE) / PGSIZE]
+
+/*
+ * address-space IDs, which tag TLB entries, so that switching
+ * page tables needn't flush the TLB. a process has two, one
+ * for its kernel page table and one for its user page table:
+ * their leaf mappings agree, but a hart may also cache their
+ * non-leaf PTEs, which don't (e.g. at TRAMPOLINE), so the
+ * trampoline's satp switches need different ASIDs to skip
+ * the flush. a process keeps its ASIDs until they run out;
+ * then a new generation starts, and each hart flushes its
+ * TLB before it next runs a process.
+ * the kernel_pagetable uses ASID 0, as do processes if the
+ * hardware has too few ASIDs for pairs; then the trampoline
+ * flushes on each switch.
+ */
+struct {
+  struct spinlock lock;
+  int nasid;   // ASIDs the hardware supports; 1 if too few
+  int next;    // next unused ASID of this generation
+  uint gen;    // generation
+} asids;
+
 /*
  * create a direct-map page table for the kernel.
  */
@@ -24,19 +73,24 @@ kvminit()
   kernel_pagetable = (pagetable_t) kalloc();
   memset(kernel_pagetable, 0, PGSIZE);
 
+  if((zeropage = kalloc()) == 0)
+    panic("kvminit: zeropage");
+  memset(zeropage, 0, PGSIZE);
+
   // uart registers
   kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
   // virtio mmio disk interface
   kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
-  // CLINT
-  kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
-
   // PLIC
   kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, for timer.c
+  kvmmap(KCLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
+  // the RAM after it is mostly mapped with megapages.
   kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
@@ -47,19 +101,133 @@ kvminit()
   kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 }
 
+// Create a kernel page table for a process: the kernel's
+// mappings, plus the user memory of pagetable, which it
+// shares with the user page table (see uvmcreate()).
+// The kernel can then dereference user addresses directly.
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(pagetable_t pagetable)
+{
+  pagetable_t kpagetable;
+
+  kpagetable = (pagetable_t) kalloc();
+  if(kpagetable == 0)
+    return 0;
+  memmove(kpagetable, kernel_pagetable, PGSIZE);
+  kvmattach(kpagetable, pagetable);
+  return kpagetable;
+}
+
+// Make kpagetable map the user memory of pagetable,
+// e.g. after exec replaces the user page table.
+void
+kvmattach(pagetable_t kpagetable, pagetable_t pagetable)
+{
+  kpagetable[0] = pagetable[0];
+  sfence_vma();
+}
+
 // Switch h/w page table register to the kernel's page table,
 // and enable paging.
 void
 kvminithart()
 {
+  if(asids.nasid == 0){
+    // the first hart finds out how many ASID bits the
+    // hardware implements: those that a write of all
+    // ones to satp's ASID field leaves set.
+    initlock(&asids.lock, "asids");
+    w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(0xffff));
+    asids.nasid = SATP2ASID(r_satp()) + 1;
+    if(asids.nasid < 3)
+      asids.nasid = 1;
+    asids.next = 1;
+    asids.gen = 1;
+  }
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
 }
 
+// Switch this hart to p's kernel page table, or to the
+// kernel_pagetable if p is 0, in the scheduler. The TLB
+// is only flushed if it may hold stale entries for p's
+// ASID. Caller must hold p->lock.
+void
+kvmswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int flushed = 0;
+
+  if(p == 0){
+    // the kernel_pagetable's mappings are all global.
+    w_satp(MAKE_SATP(kernel_pagetable));
+    return;
+  }
+
+  if(asids.nasid == 1){
+    p->asid = p->uasid = 0;
+    w_satp(MAKE_SATP(p->kpagetable));
+    sfence_vma();
+    return;
+  }
+
+  acquire(&asids.lock);
+  if(p->asidgen != asids.gen){
+    if(asids.next + 1 >= asids.nasid){
+      asids.gen++;
+      asids.next = 1;
+    }
+    p->asid = asids.next++;
+    p->uasid = asids.next++;
+    p->asidgen = asids.gen;
+  }
+  if(c->asidgen != asids.gen){
+    c->asidgen = asids.gen;
+    flushed = 1;
+  }
+  release(&asids.lock);
+
+  w_satp(MAKE_SATP(p->kpagetable) | SATP_ASID(p->asid));
+  if(flushed){
+    sfence_vma();
+  } else if(p->tlbcpu != cpuid()){
+    // p's page table may have changed since this
+    // hart last ran it.
+    sfence_vma_asid(p->asid);
+    sfence_vma_asid(p->uasid);
+  }
+  p->tlbcpu = cpuid();
+}
+
+// Split the user megapage whose level-1 PTE is pte into
+// 4096-byte pages, using its set-aside level-0 page.
+static void
+megasplit(pte_t *pte)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint flags = PTE_FLAGS(*pte);
+  pagetable_t l0;
+
+  l0 = megal0[(pa - KERNBASE) / MEGAPGSIZE];
+  if(l0 == 0)
+    panic("megasplit");
+  megal0[(pa - KERNBASE) / MEGAPGSIZE] = 0;
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  PTUSED(l0) = 512;
+  *pte = PA2PTE(l0) | PTE_V;
+  sfence_vma();
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
 //
+// A kernel megapage's level-1 PTE is returned as is;
+// a user megapage is split into 4096-byte pages, so
+// that callers only ever see level-0 user PTEs.
+//
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
 // A 64-bit virtual address is split into five fields:
@@ -76,13 +244,22 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
 
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_V) && (*pte & (PTE_R|PTE_W|PTE_X))) {
+      if((*pte & PTE_U) == 0)
+        return pte;
+      megasplit(pte);
+    }
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      pagetable_t child;
+      if(!alloc || (child = (pde_t*)kalloc_user()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
+      memset(child, 0, PGSIZE);
+      PTUSED(child) = 0;
+      PTUSED(pagetable)++;
+      *pte = PA2PTE(child) | PTE_V;
+      pagetable = child;
     }
   }
   return &pagetable[PX(0, va)];
@@ -111,14 +288,65 @@ walkaddr(pagetable_t pagetable, uint64 va)
   return pa;
 }
 
+// Map the megapage at va to pa in pagetable, with a
+// level-1 leaf PTE. va and pa must be megapage-aligned.
+// Returns 0 on success, -1 if walk() couldn't allocate
+// the level-1 page-table page.
+int
+mapmegapage(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte = &pagetable[PX(2, va)];
+  pagetable_t l1;
+
+  if(va % MEGAPGSIZE != 0 || pa % MEGAPGSIZE != 0)
+    panic("mapmegapage: not aligned");
+  if(*pte & PTE_V){
+    l1 = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((l1 = (pagetable_t)kalloc_user()) == 0)
+      return -1;
+    memset(l1, 0, PGSIZE);
+    PTUSED(l1) = 0;
+    PTUSED(pagetable)++;
+    *pte = PA2PTE(l1) | PTE_V;
+  }
+  pte = &l1[PX(1, va)];
+  if(*pte & PTE_V)
+    panic("mapmegapage: remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  PTUSED(l1)++;
+  return 0;
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// the kernel's mappings are the same in every process's
+// kernel page table, so they are global (PTE_G).
+// the megapage-aligned middle of the range is mapped
+// with megapages, to save page-table pages and TLB
+// entries, and the ends with 4096-byte pages.
 void
 kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kernel_pagetable, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 a, last;
+
+  a = PGROUNDDOWN(va);
+  last = PGROUNDUP(va + sz);
+  pa = PGROUNDDOWN(pa);
+  while(a < last){
+    if(a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && last - a >= MEGAPGSIZE){
+      if(mapmegapage(kernel_pagetable, a, pa, perm | PTE_G) != 0)
+        panic("kvmmap");
+      a += MEGAPGSIZE;
+      pa += MEGAPGSIZE;
+    } else {
+      if(mappages(kernel_pagetable, a, PGSIZE, pa, perm | PTE_G) != 0)
+        panic("kvmmap");
+      a += PGSIZE;
+      pa += PGSIZE;
+    }
+  }
 }
 
 // translate a kernel virtual address to
@@ -138,7 +366,9 @@ kvmpa(uint64 va)
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
   pa = PTE2PA(*pte);
-  return pa+off;
+  if(pte != &((pagetable_t)PTE2PA(kernel_pagetable[PX(2, va)]))[PX(1, va)])
+    return pa+off;
+  return pa + va % MEGAPGSIZE;  // a megapage
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -159,6 +389,7 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     if(*pte & PTE_V)
       panic("remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
+    PTUSED(PGROUNDDOWN((uint64)pte))++;
     if(a == last)
       break;
     a += PGSIZE;
@@ -167,9 +398,35 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Clear the level-0 PTE pte of va in pagetable, and free
+// the page-table pages on the path to it that this leaves
+// empty. The level-1 page for the lowest 1GB always stays
+// (see uvmcreate()).
+static void
+pteclear(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  pagetable_t l0 = (pagetable_t)PGROUNDDOWN((uint64)pte);
+  pagetable_t l1 = (pagetable_t)PTE2PA(pagetable[PX(2, va)]);
+
+  *pte = 0;
+  if(--PTUSED(l0) > 0)
+    return;
+  l1[PX(1, va)] = 0;
+  sfence_vma(); // the MMU may have cached the path through l0.
+  kfree(l0);
+  if(PX(2, va) == 0 || --PTUSED(l1) > 0)
+    return;
+  pagetable[PX(2, va)] = 0;
+  sfence_vma();
+  kfree(l1);
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages that were never touched (see uvmfault())
+// have no mapping and are skipped. Page-table pages are
+// freed as they become empty.
+// Optionally free the physical memory, including that of
+// pages uvmrevoke() left behind.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
@@ -180,30 +437,72 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+    if((pte = walk(pagetable, a, 0)) == 0 || *pte == 0)
+      continue;
+    if((*pte & PTE_V) == 0){
+      if((*pte & PTE_SWAP) && do_free)
+        swapfree(*pte);
+      else if(do_free)
+        kfree((void*)PTE2PA(*pte)); // revoked
+      pteclear(pagetable, a, pte);
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
       uint64 pa = PTE2PA(*pte);
       kfree((void*)pa);
     }
-    *pte = 0;
+    pteclear(pagetable, a, pte);
+  }
+}
+
+// Make the PTEs of npages pages starting at va invalid, but
+// keep their pages and flags, for uvmunmap() to free once
+// other harts' TLBs no longer map them (see tlbrevoke()).
+// Other code never sees such a PTE, since the caller holds
+// vmlock() until uvmunmap() is done.
+void
+uvmrevoke(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0)
+      continue;
+    // atomically, since another hart may be setting PTE_D.
+    if(*pte & PTE_V)
+      __sync_fetch_and_and(pte, ~PTE_V);
   }
 }
 
 // create an empty user page table.
+// the level-1 page-table page for the lowest 1GB always
+// exists, so that a process's kernel page table can share
+// it (see kvmcreate()); it also holds the kernel's device
+// mappings above MAXUVA, which lack PTE_U.
 // returns 0 if out of memory.
 pagetable_t
 uvmcreate()
 {
-  pagetable_t pagetable;
+  pagetable_t pagetable, l1, kl1;
+
   pagetable = (pagetable_t) kalloc();
   if(pagetable == 0)
     return 0;
   memset(pagetable, 0, PGSIZE);
+  if((l1 = (pagetable_t) kalloc()) == 0){
+    kfree(pagetable);
+    return 0;
+  }
+  memset(l1, 0, PGSIZE);
+  kl1 = (pagetable_t) PTE2PA(kernel_pagetable[0]);
+  for(int i = PX(1, MAXUVA); i < 512; i++)
+    l1[i] = kl1[i];
+  pagetable[0] = PA2PTE(l1) | PTE_V;
+  PTUSED(pagetable) = 1;
+  PTUSED(l1) = 0;
   return pagetable;
 }
 
@@ -233,10 +532,12 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(newsz < oldsz)
     return oldsz;
+  if(newsz > MAXUVA)
+    return 0;
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_user();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
@@ -289,52 +590,283 @@ freewalk(pagetable_t pagetable)
   kfree((void*)pagetable);
 }
 
+// Make pagetable, a new thread's, share the user memory
+// of from, its group leader's: all of it is under the
+// level-1 page-table page for the lowest 1GB.
+void
+uvmshare(pagetable_t pagetable, pagetable_t from)
+{
+  kfree((void*)PTE2PA(pagetable[0]));
+  pagetable[0] = from[0];
+}
+
+// Free a thread's page table, made by uvmshare(), but not
+// the user memory that it shares. The trampoline and
+// trapframe must already be unmapped.
+void
+uvmunshare(pagetable_t pagetable)
+{
+  pagetable[0] = 0;
+  freewalk(pagetable);
+}
+
 // Free user memory pages,
 // then free page-table pages.
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
+  pagetable_t l1;
+
   if(sz > 0)
     uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+
+  // the device mappings belong to the kernel.
+  l1 = (pagetable_t) PTE2PA(pagetable[0]);
+  for(int i = PX(1, MAXUVA); i < 512; i++)
+    l1[i] = 0;
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory from va to va+sz with a child's page table.
+// Copies the page table but not the physical
+// memory: unless shared is set, writable pages
+// become read-only copy-on-write pages in both
+// page tables, and get copied by uvmcow() on
+// the first write.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 va, uint64 sz, int shared)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = va; i < va + sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if((*pte & PTE_V) == 0){
+      // the child shares the slot of a swapped-out page.
+      if(*pte & PTE_SWAP){
+        if((npte = walk(new, i, 1)) == 0)
+          goto err;
+        *npte = *pte;
+        PTUSED(PGROUNDDOWN((uint64)npte))++;
+        swapdup(*pte);
+      }
+      continue;
+    }
+    if(!shared && (*pte & PTE_W))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kdup((void*)pa);
   }
+  sfence_vma(); // old's pages may be writable in this hart's TLB.
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
+// Resolve a write to the copy-on-write page at va:
+// give pagetable a private, writable copy, or just
+// make the page writable again if no one else
+// shares it any more.
+// Returns 0 on success, -1 if va isn't a copy-on-write
+// page or there's no memory for the copy.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+
+  if(krefcount((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if((mem = kalloc_user()) == 0)
+    return -1;
+  if((*pte & PTE_V) == 0 || PTE2PA(*pte) != pa){
+    // swapped out while kalloc_user() slept;
+    // the retried access will fault it back in.
+    kfree(mem);
+    return 0;
+  }
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Handle a page fault at user address va in pagetable;
+// write is 1 if the access was a store.
+// Pages below sz that were never touched are allocated
+// and zeroed here, or just read as the zero page, stores
+// to copy-on-write pages get a private copy, and
+// swapped-out pages are read back in.
+// Returns 0 if the access can now proceed, -1 if it's
+// invalid or there's no memory.
+int
+uvmfault(pagetable_t pagetable, uint64 va, uint64 sz, int write)
+{
+  pte_t *pte;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(!write || (*pte & PTE_COW) == 0 || uvmcow(pagetable, va) < 0)
+      return -1;
+    sfence_vma();
+    return 0;
+  }
+  if(pte && (*pte & PTE_SWAP)){
+    if(swapin(pagetable, va) < 0)
+      return -1;
+    sfence_vma();
+    return 0;
+  }
+
+  if(va >= sz)
+    return -1;
+  if(!write)
+    return uvmzero(pagetable, va, PTE_W|PTE_X|PTE_R|PTE_U);
+  if((mem = kalloc_user()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  sfence_vma();
+  return 0;
+}
+
+// Map the zero page at va in pagetable, for a read of an
+// anonymous page that has never been written. If perm
+// allows writes, the page is copy-on-write instead.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmzero(pagetable_t pagetable, uint64 va, int perm)
+{
+  if(perm & PTE_W)
+    perm = (perm & ~PTE_W) | PTE_COW;
+  kdup(zeropage);
+  if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, perm) != 0){
+    kfree(zeropage);
+    return -1;
+  }
+  __sync_fetch_and_add(&nzerofault, 1);
+  sfence_vma();
+  return 0;
+}
+
+// Is va mapped by a user megapage in pagetable?
+// Lets callers skip it without splitting it up.
+int
+ismegapage(pagetable_t pagetable, uint64 va)
+{
+  pte_t pte = pagetable[PX(2, va)];
+
+  if((pte & PTE_V) == 0 || (pte & (PTE_R|PTE_W|PTE_X)))
+    return 0;
+  pte = ((pagetable_t)PTE2PA(pte))[PX(1, va)];
+  return (pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) && (pte & (PTE_R|PTE_W|PTE_X));
+}
+
+// Map a zeroed user megapage over the megapage-aligned
+// region of pagetable around va, on a store to a page of
+// it. The caller must make sure that the whole region is
+// anonymous memory below p->sz. Nothing must be mapped in
+// the region yet: not even a level-0 page-table page.
+// Returns 0 on success, -1 if the caller should fall
+// back to 4096-byte pages.
+int
+uvmmegafault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t l0;
+  char *mem;
+
+  va = MEGAPGROUNDDOWN(va);
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V){
+    pte = &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+    if(*pte != 0)
+      return -1;
+  }
+
+  if((mem = kalloc_pages(9)) == 0)
+    return -1;
+  if((l0 = kalloc()) == 0){
+    kfree_pages(mem, 9);
+    return -1;
+  }
+  memset(mem, 0, MEGAPGSIZE);
+  ksplit_pages(mem, 9);
+  megal0[((uint64)mem - KERNBASE) / MEGAPGSIZE] = l0;
+  if(mapmegapage(pagetable, va, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    megal0[((uint64)mem - KERNBASE) / MEGAPGSIZE] = 0;
+    for(int i = 0; i < 512; i++)
+      kfree(mem + i*PGSIZE);
+    kfree(l0);
+    return -1;
+  }
+  __sync_fetch_and_add(&nmegafault, 1);
+  sfence_vma();
+  return 0;
+}
+
+// Report the zero page's and megapages' use, for the
+// statistics device.
+int
+vmstats(char *buf, int sz)
+{
+  int n;
+
+  n = snprintf(buf, sz, "zero page: %d pages saved, %d faults\n",
+               krefcount(zeropage) - 1, nzerofault);
+  n += snprintf(buf + n, sz - n, "megapages: %d faults\n", nmegafault);
+  return n;
+}
+
+// Look up user address va for a kernel copy into or out
+// of a page table other than the current process's (e.g.
+// exec's new image), first giving pagetable a private copy
+// of a copy-on-write page that's to be written.
+// Returns the physical address of the page, or 0.
+static uint64
+uvmpa(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(write && pte && (*pte & PTE_COW) && uvmcow(pagetable, va) < 0)
+    return 0;
+  return walkaddr(pagetable, va);
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -350,15 +882,21 @@ uvmclear(pagetable_t pagetable, uint64 va)
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// The current process's memory is written directly,
+// through its kernel page table.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct proc *p = myproc();
+
+  if(p && pagetable == p->pagetable)
+    return copyout_new(dstva, src, len);
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmpa(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -375,15 +913,20 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
 // Copy from user to kernel.
 // Copy len bytes to dst from virtual address srcva in a given page table.
+// The current process's memory is read directly.
 // Return 0 on success, -1 on error.
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct proc *p = myproc();
+
+  if(p && pagetable == p->pagetable)
+    return copyin_new(dst, srcva, len);
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmpa(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -401,16 +944,21 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
+// The current process's memory is read directly.
 // Return 0 on success, -1 on error.
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  struct proc *p = myproc();
+
+  if(p && pagetable == p->pagetable)
+    return copyinstr_new(dst, srcva, max);
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmpa(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
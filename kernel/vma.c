@@ -0,0 +1,595 @@
+//
+// Memory-mapped files: mmap() and munmap(), and the
+// program segments and stack of exec().
+//
+// Each process has a small table of mappings (p->vma[]).
+// exec() adds one per program segment, below p->sz, and
+// one for the stack, which has no file, just below MAXUVA.
+// mmap() places them downward from the stack, above the heap.
+// Pages are read from the file when first touched;
+// pagefault() is the entry point for page faults from
+// usertrap() and kerneltrap(). Dirty pages of MAP_SHARED
+// mappings are written back to the file through the log
+// when they are unmapped, by munmap(), exec() or exit().
+//
+// vmlock() is never held while locking an inode or the log:
+// a thread may hold those in read() or write() while its
+// copy faults and waits for vmlock(). So pages are read from
+// files, and written back, with vmlock() released, and the
+// files of closed mappings are iput() by vmaput() after it.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// Return the mapping of p that contains va, or 0.
+// Mappings that munmap() is taking down don't count.
+static struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len > 0 && (v->flags & VMA_UNMAP) == 0 &&
+       va >= v->addr && va < v->addr + v->len)
+      return v;
+  }
+  return 0;
+}
+
+// Lowest address used by p's mmap()ed files and stack,
+// or MAXUVA if none. The heap (p->sz) must stay below it.
+// A guard page is left below the stack, so that a stack
+// overflow faults rather than running into other memory.
+uint64
+vmabottom(struct proc *p)
+{
+  struct vma *v;
+  uint64 bottom = MAXUVA, a;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || (v->flags & VMA_EXEC))
+      continue;
+    a = v->addr;
+    if(v->flags & VMA_STACK)
+      a -= PGSIZE;
+    if(a < bottom)
+      bottom = a;
+  }
+  return bottom;
+}
+
+// Free mapping v. Returns its file, whose reference the
+// caller must drop with vmaput() once it has released
+// vmlock(), or 0.
+static struct inode*
+vmaclose(struct vma *v)
+{
+  struct inode *ip = v->ip;
+
+  if(ip && (v->flags & VMA_EXEC))
+    iallowwrite(ip);
+  v->ip = 0;
+  v->len = 0;
+  return ip;
+}
+
+// Drop a reference to ip that a mapping of p's thread
+// group held, without vmlock(). Faults that are reading
+// pages of the mapping borrow the reference (see
+// vmafault()), so wait for them first.
+void
+vmaput(struct proc *p, struct inode *ip)
+{
+  struct proc *g = p->group;
+
+  if(ip == 0)
+    return;
+  acquire(&g->vmlk);
+  while(g->vmfaulting > 0)
+    sleep(&g->vmfaulting, &g->vmlk);
+  release(&g->vmlk);
+  begin_op();
+  iput(ip);
+  end_op();
+}
+
+// The PTE permissions for the pages of mapping v.
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Read the page of mapping v at va from the file, or
+// zero-fill it if it's past the part from the file.
+// p is the group leader, and vmlock() is held, but is
+// released while the file is read.
+// Returns 0 if the access can now proceed, or should be
+// retried, -1 on failure.
+static int
+vmafault(struct proc *p, struct vma *v, uint64 va, int write)
+{
+  struct inode *ip = v->ip;
+  uint64 n, pgoff, off;
+  pte_t *pte;
+  char *mem;
+  int perm, text;
+
+  if((v->prot & (PROT_READ|PROT_WRITE|PROT_EXEC)) == 0)
+    return -1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+
+  // present but copy-on-write, after fork of a
+  // MAP_PRIVATE mapping, or swapped out.
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & (PTE_V|PTE_SWAP)))
+    return uvmfault(p->pagetable, va, 0, write);
+
+  pgoff = va - v->addr;
+
+  // a read of a page of bss or of the stack.
+  if(!write && (v->flags & (VMA_EXEC|VMA_STACK)) && pgoff >= v->filesz)
+    return uvmzero(p->pagetable, va, vmaperm(v));
+
+  // the rest of the page past filesz, or past the
+  // end of the file, stays zero.
+  n = 0;
+  if(pgoff < v->filesz)
+    n = v->filesz - pgoff < PGSIZE ? v->filesz - pgoff : PGSIZE;
+  if(n == 0){
+    if((mem = kalloc_user()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, vmaperm(v)) != 0){
+      kfree(mem);
+      return -1;
+    }
+    sfence_vma();
+    return 0;
+  }
+
+  // read the page without vmlock(), borrowing v's
+  // reference to the file: p->vmfaulting holds off
+  // vmaput() until the read is done.
+  off = v->off + pgoff;
+  acquire(&p->vmlk);
+  p->vmfaulting++;
+  release(&p->vmlk);
+  vmunlock(p);
+
+  // whole pages of program text come from the page
+  // cache, shared with other processes running the
+  // same program; a store must copy the page.
+  text = !write && (v->flags & VMA_EXEC) && n == PGSIZE;
+  mem = 0;
+  if(text && (mem = pcacheget(ip, off)) == 0)
+    text = 0;
+  if(mem == 0 && (mem = kalloc_user()) != 0){
+    memset(mem, 0, PGSIZE);
+    ilock(ip);
+    if(readi(ip, 0, (uint64)mem, off, n) < 0){
+      kfree(mem);
+      mem = 0;
+    }
+    iunlock(ip);
+  }
+
+  vmlock(p);
+  acquire(&p->vmlk);
+  if(--p->vmfaulting == 0)
+    wakeup(&p->vmfaulting);
+  release(&p->vmlk);
+  if(mem == 0)
+    return -1;
+
+  // another thread may have changed the mapping, or
+  // mapped the page, meanwhile. If so, let the access
+  // fault again.
+  if((v = vmalookup(p, va)) == 0 || v->ip != ip ||
+     v->off + (va - v->addr) != off ||
+     ((pte = walk(p->pagetable, va, 0)) != 0 && *pte != 0)){
+    kfree(mem);
+    return 0;
+  }
+
+  perm = vmaperm(v);
+  if(text && (perm & PTE_W))
+    perm = (perm & ~PTE_W) | PTE_COW;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  sfence_vma();
+  return 0;
+}
+
+// Is the megapage-aligned region around va all heap,
+// below p->sz and clear of program segments?
+static int
+megaheap(struct proc *p, uint64 va)
+{
+  uint64 start = MEGAPGROUNDDOWN(va), end = start + MEGAPGSIZE;
+  struct vma *v;
+
+  if(end > p->sz)
+    return 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len > 0 && v->addr < end && v->addr + v->len > start)
+      return 0;
+  }
+  return 1;
+}
+
+// Handle a page fault by p at user address va; scause is
+// 12, 13 or 15 for an instruction fetch, a load or a store.
+// Mapped files are read in, the heap is allocated lazily,
+// and copy-on-write pages are copied. The memory is its
+// thread group's, so other threads may be faulting too.
+// Returns 0 if the access can now proceed, -1 if not.
+int
+pagefault(struct proc *p, uint64 va, uint64 scause)
+{
+  struct proc *g = p->group;
+  struct vma *v;
+  pte_t *pte, old = 0;
+  int write = scause == 15, need, r;
+
+  p->ru.nfault++;
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  vmlock(p);
+
+  need = write ? PTE_W : scause == 12 ? PTE_X : PTE_R;
+  if(!ismegapage(g->pagetable, va) && (pte = walk(g->pagetable, va, 0)) != 0)
+    old = *pte;
+  if(ismegapage(g->pagetable, va) ||
+     ((old & (PTE_V|PTE_U)) == (PTE_V|PTE_U) && (old & need))){
+    // another thread mapped the page since this hart's
+    // TLB looked, or the TLB is out of date.
+    sfence_vma();
+    r = 0;
+  } else if((v = vmalookup(g, va)) != 0){
+    r = vmafault(g, v, va, write);
+  } else if(write && megaheap(g, va) && uvmmegafault(g->pagetable, va) == 0){
+    // a store to a heap megapage that is all untouched
+    // gets a megapage; reads map the zero page instead.
+    r = 0;
+  } else {
+    r = uvmfault(g->pagetable, va, g->sz, write);
+  }
+
+  // other threads mustn't go on using the old page
+  // of a copy-on-write page that was copied.
+  if(r == 0 && (old & PTE_V) && (pte = walk(g->pagetable, va, 0)) != 0 &&
+     PTE2PA(*pte) != PTE2PA(old))
+    tlbshootdown(p);
+  vmunlock(p);
+  return r;
+}
+
+// Read in the mapped-file and swapped-out pages of
+// [va, va+len) in the current process, before read() or
+// write() copy to or from them. Otherwise the copy could
+// fault while the file system holds an inode lock, and the
+// fault would need to lock another inode to read its page.
+// Errors are left for the copy to report.
+void
+vmaprefault(uint64 va, uint64 len)
+{
+  struct proc *p = myproc(), *g = p->group;
+  struct vma *v, *w;
+  uint64 a, start, end;
+  pte_t *pte;
+
+  vmlock(p);
+
+  end = va + len < g->sz ? va + len : g->sz;
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    if(ismegapage(g->pagetable, a)){
+      a = MEGAPGROUNDDOWN(a) + MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    pte = walk(g->pagetable, a, 0);
+    if(pte && (*pte & PTE_SWAP))
+      uvmfault(g->pagetable, a, g->sz, 0);
+  }
+
+  // vmafault() releases vmlock() while it reads, so
+  // look each page's mapping up afresh.
+  for(v = g->vma; v < &g->vma[NVMA]; v++){
+    if(v->len == 0 || v->ip == 0 || (v->flags & VMA_UNMAP))
+      continue;
+    start = va > v->addr ? va : v->addr;
+    end = va + len < v->addr + v->len ? va + len : v->addr + v->len;
+    for(a = PGROUNDDOWN(start); a < end; a += PGSIZE){
+      pte = walk(g->pagetable, a, 0);
+      if((pte == 0 || (*pte & PTE_V) == 0) && (w = vmalookup(g, a)) != 0 &&
+         w->ip != 0)
+        vmafault(g, w, a, 0);
+    }
+  }
+  vmunlock(p);
+}
+
+// Write the dirty page at va of the shared mapping v,
+// whose physical address is pa, back to the file.
+// The file doesn't grow: bytes past its end are dropped.
+static void
+vmawriteback(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->ip;
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint off = v->off + (va - v->addr);
+  uint n, n1, i;
+
+  for(i = 0; i < PGSIZE; i += n1){
+    begin_op();
+    ilock(ip);
+    if(off + i >= ip->size){
+      iunlock(ip);
+      end_op();
+      break;
+    }
+    n = ip->size - (off + i);
+    n1 = PGSIZE - i;
+    if(n1 > n)
+      n1 = n;
+    if(n1 > max)
+      n1 = max;
+    writei(ip, 0, pa + i, off + i, n1);
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Write the dirty pages of [va, va+len) of mapping v back,
+// if it's shared, without vmlock(). Other threads mustn't
+// be able to change those PTEs meanwhile.
+// They may have been revoked (see tlbrevoke()).
+static void
+vmasync(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+
+  if((v->flags & MAP_SHARED) == 0)
+    return;
+  for(a = va; a < va + len; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    // swapped-out pages are clean.
+    if(pte && (*pte & PTE_SWAP) == 0 && (*pte & PTE_D))
+      vmawriteback(v, a, PTE2PA(*pte));
+  }
+}
+
+// Remove the pages of [va, va+len) of mapping v from
+// p's page table. They may have been revoked.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || *pte == 0)
+      continue;
+    uvmunmap(p->pagetable, a, 1, 1);
+  }
+  sfence_vma();
+}
+
+// Map len bytes of file f, starting at offset off, into
+// the current process. The address hint is ignored.
+// Returns the address of the mapping, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc(), *g = p->group;
+  struct vma *v, *free = 0;
+
+  if(len == 0 || len > MAXUVA || off % PGSIZE != 0)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  // writes to a shared mapping end up in the file.
+  if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+
+  vmlock(p);
+  for(v = g->vma; v < &g->vma[NVMA]; v++){
+    if(v->len == 0){
+      free = v;
+      break;
+    }
+  }
+  len = PGROUNDUP(len);
+  addr = vmabottom(g);
+  if(free == 0 || addr - PGROUNDUP(g->sz) < len){
+    vmunlock(p);
+    return -1;
+  }
+  addr -= len;
+
+  v = free;
+  v->addr = addr;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags & (MAP_SHARED|MAP_PRIVATE);
+  v->off = off;
+  v->filesz = len;
+  v->ip = idup(f->ip);
+  vmunlock(p);
+  return addr;
+}
+
+// Unmap [addr, addr+len) from the current process. The
+// range must be at the start or the end of a mapping,
+// or all of it. Returns 0 on success, -1 on failure.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc(), *g = p->group;
+  struct vma *v, *d;
+  struct inode *ip;
+
+  if(addr % PGSIZE != 0)
+    return -1;
+  if(len == 0)
+    return 0;
+  len = PGROUNDUP(len);
+  vmlock(p);
+  if((v = vmalookup(g, addr)) == 0 || (v->flags & (VMA_EXEC|VMA_STACK)) ||
+     len > v->addr + v->len - addr ||
+     (addr != v->addr && addr + len != v->addr + v->len)){
+    vmunlock(p);
+    return -1;
+  }
+
+  // the range moves to a mapping d of its own, marked
+  // VMA_UNMAP, while its dirty pages are written back
+  // without vmlock(): faults don't see d, and mmap()
+  // doesn't reuse its addresses.
+  d = v;
+  if(len < v->len){
+    for(d = g->vma; d < &g->vma[NVMA] && d->len > 0; d++)
+      ;
+    if(d == &g->vma[NVMA]){
+      vmunlock(p);
+      return -1;
+    }
+    *d = *v;
+    d->addr = addr;
+    d->len = len;
+    d->off = v->off + (addr - v->addr);
+    d->filesz = len;
+    idup(d->ip);
+    if(addr == v->addr){
+      v->addr += len;
+      v->off += len;
+      v->filesz -= len;
+    }
+    v->len -= len;
+  }
+  d->flags |= VMA_UNMAP;
+  tlbrevoke(p, addr, addr + len);
+  vmunlock(p);
+
+  vmasync(g, d, addr, len);
+
+  vmlock(p);
+  vmaunmap(g, d, addr, len);
+  ip = vmaclose(d);
+  vmunlock(p);
+  vmaput(p, ip);
+  return 0;
+}
+
+// Unmap all of p's mappings, for exit() and exec(),
+// when p has no other threads.
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmasync(p, v, v->addr, v->len);
+    vmaunmap(p, v, v->addr, v->len);
+    vmaput(p, vmaclose(v));
+  }
+}
+
+// p's memory has shrunk to sz: forget the parts of its
+// program segments above it, whose pages are gone.
+// The files of those that are gone entirely go in
+// put[NVMA], for vmaput() after vmunlock().
+void
+vmashrink(struct proc *p, uint64 sz, struct inode **put)
+{
+  struct vma *v;
+
+  sz = PGROUNDUP(sz);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    put[v - p->vma] = 0;
+    if(v->len == 0 || (v->flags & VMA_EXEC) == 0 || v->addr + v->len <= sz)
+      continue;
+    if(v->addr >= sz){
+      put[v - p->vma] = vmaclose(v);
+    } else {
+      v->len = sz - v->addr;
+      if(v->filesz > v->len)
+        v->filesz = v->len;
+    }
+  }
+}
+
+// Give the child np the mappings of p, for fork().
+// The pages of MAP_SHARED mappings are shared; those
+// of MAP_PRIVATE mappings and the stack become
+// copy-on-write.
+// Program segments lie below p->sz, so their pages
+// have already been copied with the rest of memory.
+// Returns 0 on success, -1 on failure, in which
+// case np has no mappings.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || (v->flags & (VMA_EXEC|VMA_UNMAP)))
+      continue;
+    if(uvmcopy(p->pagetable, np->pagetable, v->addr, v->len,
+               (v->flags & MAP_SHARED) != 0) < 0)
+      goto err;
+  }
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    np->vma[v - p->vma] = *v;
+    // a range on its way out (see munmap()).
+    if(v->flags & VMA_UNMAP){
+      np->vma[v - p->vma].len = 0;
+      np->vma[v - p->vma].ip = 0;
+      continue;
+    }
+    if(v->len > 0 && v->ip){
+      idup(v->ip);
+      if(v->flags & VMA_EXEC)
+        idenywrite(v->ip);
+    }
+  }
+  return 0;
+
+ err:
+  for(v--; v >= p->vma; v--){
+    if(v->len == 0 || (v->flags & (VMA_EXEC|VMA_UNMAP)))
+      continue;
+    uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+  }
+  return -1;
+}
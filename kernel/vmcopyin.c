@@ -0,0 +1,155 @@
+#include "param.h"
+#include "types.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+//
+// copyin/copyout for the current process, which read and
+// write user memory directly: the process's kernel page table
+// maps user memory at the same virtual addresses, so the
+// hardware does the translation instead of walk().
+//
+// pages that are lazy or copy-on-write cause page faults,
+// which kerneltrap() handles while p->ucopy is set.
+// SUM lets the kernel touch pages without PTE_U too, which
+// the user can't, so each page is checked first.
+//
+
+// let the kernel touch PTE_U pages, and have
+// kerneltrap() handle faults on them.
+static void
+ubegin(struct proc *p)
+{
+  p->ucopyerr = 0;
+  p->ucopy = 1;
+  __sync_synchronize();
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+}
+
+// returns -1 if some user access couldn't be
+// faulted in, 0 otherwise.
+static int
+uend(struct proc *p)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  __sync_synchronize();
+  p->ucopy = 0;
+  return p->ucopyerr ? -1 : 0;
+}
+
+// is the page at va mapped without PTE_U? then fail the
+// copy. pages that aren't mapped are left to fault.
+// interrupts stay off during the walk, so that another
+// thread's munmap() can't free page-table pages under it
+// (see tlbshootdown()). returns 0 if the copy may go on.
+static int
+ucheck(struct proc *p, uint64 va)
+{
+  pagetable_t pagetable = p->kpagetable;
+  pte_t pte = 0;
+
+  push_off();
+  for(int level = 2; level >= 0; level--){
+    pte = pagetable[PX(level, va)];
+    if((pte & PTE_V) == 0 || (pte & (PTE_R|PTE_W|PTE_X)))
+      break;
+    pagetable = (pagetable_t)PTE2PA(pte);
+  }
+  pop_off();
+  if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) && (pte & PTE_U) == 0)
+    p->ucopyerr = 1;
+  return p->ucopyerr ? -1 : 0;
+}
+
+// Copy from user to kernel.
+// Copy len bytes to dst from virtual address srcva.
+// Return 0 on success, -1 on error.
+int
+copyin_new(char *dst, uint64 srcva, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 n;
+
+  if(srcva >= MAXUVA || len > MAXUVA - srcva)
+    return -1;
+
+  // a page at a time, to give up soon after a bad page.
+  ubegin(p);
+  while(len > 0 && ucheck(p, srcva) == 0){
+    n = PGSIZE - (srcva % PGSIZE);
+    if(n > len)
+      n = len;
+    memmove(dst, (void *)srcva, n);
+    len -= n;
+    dst += n;
+    srcva += n;
+  }
+  return uend(p);
+}
+
+// Copy from kernel to user.
+// Copy len bytes from src to virtual address dstva.
+// Return 0 on success, -1 on error.
+int
+copyout_new(uint64 dstva, char *src, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 n;
+
+  if(dstva >= MAXUVA || len > MAXUVA - dstva)
+    return -1;
+
+  ubegin(p);
+  while(len > 0 && ucheck(p, dstva) == 0){
+    n = PGSIZE - (dstva % PGSIZE);
+    if(n > len)
+      n = len;
+    memmove((void *)dstva, src, n);
+    len -= n;
+    src += n;
+    dstva += n;
+  }
+  return uend(p);
+}
+
+// Copy a null-terminated string from user to kernel.
+// Copy bytes to dst from virtual address srcva,
+// until a '\0', or max.
+// Return 0 on success, -1 on error.
+int
+copyinstr_new(char *dst, uint64 srcva, uint64 max)
+{
+  struct proc *p = myproc();
+  char *s = (char *) srcva;
+  int got_null = 0;
+
+  if(srcva >= MAXUVA)
+    return -1;
+  if(max > MAXUVA - srcva)
+    max = MAXUVA - srcva;
+
+  ubegin(p);
+  while(max > 0){
+    if((s == (char *) srcva || (uint64)s % PGSIZE == 0) &&
+       ucheck(p, (uint64)s) < 0)
+      break;
+    *dst = *s;
+    // a fault that couldn't be handled skipped the load.
+    if(p->ucopyerr)
+      break;
+    if(*dst == '\0'){
+      got_null = 1;
+      break;
+    }
+    --max;
+    s++;
+    dst++;
+  }
+  if(uend(p) < 0 || !got_null)
+    return -1;
+  return 0;
+}
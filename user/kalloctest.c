@@ -0,0 +1,90 @@
+//
+// Measure physical page allocator throughput with
+// 1..NCPU processes allocating and freeing in parallel.
+// Each child repeatedly grows its heap, touches every new
+// page (so the kernel really has to kalloc() it), checks the
+// contents, and shrinks the heap again (kfree()).
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGES  32    // pages per grow/shrink round
+#define ROUNDS  200   // rounds per child
+
+void
+worker(int id)
+{
+  char *a;
+  int r, i;
+
+  for(r = 0; r < ROUNDS; r++){
+    a = sbrk(NPAGES * PGSIZE);
+    if(a == (char*)-1){
+      printf("kalloctest: sbrk failed\n");
+      exit(1);
+    }
+    for(i = 0; i < NPAGES; i++)
+      a[i * PGSIZE] = id + i;
+    for(i = 0; i < NPAGES; i++){
+      if(a[i * PGSIZE] != (char)(id + i)){
+        printf("kalloctest: wrong content\n");
+        exit(1);
+      }
+    }
+    if(sbrk(-NPAGES * PGSIZE) == (char*)-1){
+      printf("kalloctest: sbrk shrink failed\n");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+// run n workers in parallel; returns elapsed ticks.
+int
+run(int n)
+{
+  int i, pid, xstatus, t0, t1;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("kalloctest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      worker(i);
+  }
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("kalloctest: worker failed\n");
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  return t1 - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, ticks, pages;
+
+  printf("kalloctest: %d pages per round, %d rounds per process\n",
+         NPAGES, ROUNDS);
+  for(n = 1; n <= NCPU; n++){
+    ticks = run(n);
+    pages = n * NPAGES * ROUNDS;
+    if(ticks == 0)
+      ticks = 1;
+    printf("kalloctest: %d procs: %d pages in %d ticks (%d pages/tick)\n",
+           n, pages, ticks, pages / ticks);
+  }
+  printf("kalloctest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,270 @@
+//
+// tests for lazy allocation of sbrk() memory
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define REGION_SZ (128 * 1024 * 1024)
+
+// reserve as much memory as the machine has,
+// and touch only one byte in each 64 pages.
+void
+sparse_memory(char *s)
+{
+  char *i, *prev_end, *new_end;
+
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE)
+    *(char **)i = i;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += 64 * PGSIZE){
+    if(*(char **)i != i){
+      printf("failed to read value from memory\n");
+      exit(1);
+    }
+  }
+
+  exit(0);
+}
+
+// touch sparse pages, shrink, and check that the
+// freed pages are really gone.
+void
+sparse_memory_unmap(char *s)
+{
+  int pid;
+  char *i, *prev_end, *new_end;
+
+  prev_end = sbrk(REGION_SZ);
+  if(prev_end == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  new_end = prev_end + REGION_SZ;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += PGSIZE * PGSIZE)
+    *(char **)i = i;
+
+  for(i = prev_end + PGSIZE; i < new_end; i += PGSIZE * PGSIZE){
+    pid = fork();
+    if(pid < 0){
+      printf("error forking\n");
+      exit(1);
+    } else if(pid == 0){
+      sbrk(-1L * REGION_SZ);
+      *(char **)i = i;
+      exit(0);
+    } else {
+      int status;
+      wait(&status);
+      if(status == 0){
+        printf("memory not unmapped\n");
+        exit(1);
+      }
+    }
+  }
+
+  exit(0);
+}
+
+// a process that reserves more than all of memory
+// and then touches it all must be killed, not hang
+// or crash the kernel.
+void
+oom(char *s)
+{
+  void *m1, *m2;
+  int pid;
+
+  if((pid = fork()) == 0){
+    m1 = 0;
+    while((m2 = malloc(4096*4096)) != 0){
+      *(char**)m2 = m1;
+      m1 = m2;
+    }
+    exit(0);
+  } else {
+    int xstatus;
+    wait(&xstatus);
+    exit(xstatus == 0);
+  }
+}
+
+// system calls must fault in lazily-allocated pages
+// that they read or write.
+void
+syscallarg(char *s)
+{
+  char *a;
+  int fd, fds[2];
+
+  a = sbrk(2 * PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+
+  // write() reads from an untouched page.
+  fd = open("lazy", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("open failed\n");
+    exit(1);
+  }
+  if(write(fd, a, PGSIZE) != PGSIZE){
+    printf("write of lazy page failed\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("lazy");
+
+  // read() writes into an untouched page.
+  if(pipe(fds) != 0){
+    printf("pipe failed\n");
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  if(read(fds[0], a + PGSIZE, 1) != 1 || a[PGSIZE] != 'x'){
+    printf("read into lazy page failed\n");
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  exit(0);
+}
+
+// the number in the statistics device's report after
+// the text what, or -1.
+int
+statistic(char *what)
+{
+  static char buf[1024];
+  int fd, n, tot;
+  char *p;
+
+  if((fd = open("statistics", O_RDONLY)) < 0)
+    return -1;
+  for(tot = 0; tot < sizeof(buf) - 1; tot += n){
+    if((n = read(fd, buf + tot, sizeof(buf) - 1 - tot)) <= 0)
+      break;
+  }
+  close(fd);
+  buf[tot] = 0;
+  for(p = buf; *p; p++){
+    if(strlen(p) >= strlen(what) && memcmp(p, what, strlen(what)) == 0)
+      return atoi(p + strlen(what));
+  }
+  return -1;
+}
+
+#define NZERO 256
+
+// pages that are only read share the zero page.
+void
+zeropage(char *s)
+{
+  char *a;
+  int i, sum, before, after;
+
+  before = statistic("zero page: ");
+  a = sbrk(NZERO * PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("sbrk() failed\n");
+    exit(1);
+  }
+  sum = 0;
+  for(i = 0; i < NZERO; i++)
+    sum += a[i * PGSIZE];
+  after = statistic("zero page: ");
+  if(sum != 0){
+    printf("untouched memory isn't zero\n");
+    exit(1);
+  }
+  if(before < 0 || after - before < NZERO){
+    printf("zero page saved %d pages, not %d\n", after - before, NZERO);
+    exit(1);
+  }
+
+  // a store gets a private page.
+  a[0] = 1;
+  if(a[0] != 1 || a[PGSIZE] != 0){
+    printf("store to a zero page failed\n");
+    exit(1);
+  }
+
+  exit(0);
+}
+
+// run each test in its own process. run returns 1 if child's exit()
+// indicates success.
+int
+run(void f(char *), char *s)
+{
+  int pid;
+  int xstatus;
+
+  printf("running test %s\n", s);
+  if((pid = fork()) < 0){
+    printf("runtest: fork error\n");
+    exit(1);
+  }
+  if(pid == 0){
+    f(s);
+    exit(0);
+  } else {
+    wait(&xstatus);
+    if(xstatus != 0)
+      printf("test %s: FAILED\n", s);
+    else
+      printf("test %s: OK\n", s);
+    return xstatus == 0;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *n = 0;
+  if(argc > 1){
+    n = argv[1];
+  }
+
+  struct test {
+    void (*f)(char *);
+    char *s;
+  } tests[] = {
+    { sparse_memory, "lazy alloc"},
+    { sparse_memory_unmap, "lazy unmap"},
+    { syscallarg, "lazy syscall args"},
+    { zeropage, "zero page"},
+    { oom, "out of memory"},
+    { 0, 0},
+  };
+
+  printf("lazytests starting\n");
+
+  int fail = 0;
+  for(struct test *t = tests; t->s != 0; t++){
+    if((n == 0) || strcmp(t->s, n) == 0){
+      if(!run(t->f, t->s))
+        fail = 1;
+    }
+  }
+  if(!fail)
+    printf("ALL TESTS PASSED\n");
+  else
+    printf("SOME TESTS FAILED\n");
+  exit(fail);
+}
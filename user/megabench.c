@@ -0,0 +1,96 @@
+//
+// compare the speed of memory mapped with 4096-byte
+// pages and with megapages.
+//
+// the kernel maps a megapage when a program first stores
+// to a megapage-aligned stretch of untouched heap. a region
+// that is read first gets the zero page and then 4096-byte
+// pages; a region that is written first gets megapages.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define REGION_SZ (8 * MEGAPGSIZE)
+#define NPAGES (REGION_SZ / PGSIZE)
+#define ROUNDS 400
+
+// the number in the statistics device's report after
+// the text what, or -1.
+int
+statistic(char *what)
+{
+  static char buf[1024];
+  int fd, n, tot;
+  char *p;
+
+  if((fd = open("statistics", O_RDONLY)) < 0)
+    return -1;
+  for(tot = 0; tot < sizeof(buf) - 1; tot += n){
+    if((n = read(fd, buf + tot, sizeof(buf) - 1 - tot)) <= 0)
+      break;
+  }
+  close(fd);
+  buf[tot] = 0;
+  for(p = buf; *p; p++){
+    if(strlen(p) >= strlen(what) && memcmp(p, what, strlen(what)) == 0)
+      return atoi(p + strlen(what));
+  }
+  return -1;
+}
+
+// touch one word in every page of the region, ROUNDS
+// times, in an order that defeats the TLB and caches.
+// returns the number of ticks taken.
+int
+touch(char *region)
+{
+  int i, r, t0;
+  uint64 sum = 0;
+
+  t0 = uptime();
+  for(r = 0; r < ROUNDS; r++){
+    // 1031 is prime, so this visits every page.
+    for(i = 0; i < NPAGES; i++)
+      sum += ++*(uint64 *)(region + ((i * 1031) % NPAGES) * PGSIZE);
+  }
+  if(sum == 0)
+    printf("megabench: impossible\n");
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *a, *b, *q;
+  int before, after, ta, tb;
+
+  // start the regions on a megapage boundary.
+  q = sbrk(0);
+  if(sbrk(MEGAPGROUNDUP((uint64)q) - (uint64)q) == (char*)-1 ||
+     (a = sbrk(2 * REGION_SZ)) == (char*)-1){
+    printf("megabench: sbrk failed\n");
+    exit(1);
+  }
+  b = a + REGION_SZ;
+
+  before = statistic("megapages: ");
+  for(q = a; q < a + REGION_SZ; q += PGSIZE)
+    if(*q != 0)
+      printf("megabench: untouched memory isn't zero\n");
+  for(q = a; q < a + REGION_SZ; q += PGSIZE)
+    *q = 1;
+  for(q = b; q < b + REGION_SZ; q += PGSIZE)
+    *q = 1;
+  after = statistic("megapages: ");
+
+  ta = touch(a);
+  tb = touch(b);
+  printf("4096-byte pages: %d ticks\n", ta);
+  printf("megapages: %d ticks (%d mapped)\n", tb, after - before);
+  exit(0);
+}
@@ -0,0 +1,266 @@
+//
+// tests for mmap() and munmap()
+//
+
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define MAP_FAILED ((char *) -1)
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("mmaptest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// create a file of 2.5 pages, byte i of page p is 'A'+p.
+void
+makefile(const char *f)
+{
+  int i;
+  int n = PGSIZE/BSIZE;
+  char buf[BSIZE];
+
+  unlink(f);
+  int fd = open(f, O_WRONLY | O_CREATE);
+  if(fd == -1)
+    err("open");
+  for(i = 0; i < n*2 + n/2; i++){
+    memset(buf, 'A' + i/n, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE)
+      err("write 0 makefile");
+  }
+  if(close(fd) == -1)
+    err("close");
+}
+
+// check the 2.5 pages of makefile() at p, and that the
+// rest of the third page is zero.
+void
+checkfile(char *p)
+{
+  for(int i = 0; i < PGSIZE*3; i++){
+    char want = i < PGSIZE*2 + PGSIZE/2 ? 'A' + i/PGSIZE : 0;
+    if(p[i] != want){
+      printf("mismatch at %d, wanted '%c', got '%c'\n", i, want, p[i]);
+      err("v1 mismatch");
+    }
+  }
+}
+
+void
+private_test(void)
+{
+  const char * const f = "mmap.dur";
+  char *p;
+  int fd;
+
+  testname = "private";
+  makefile(f);
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+
+  // a read-only mapping.
+  p = mmap(0, PGSIZE*3, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap (1)");
+  checkfile(p);
+  if(munmap(p, PGSIZE*3) == -1)
+    err("munmap (1)");
+
+  // a writable private mapping of a read-only file;
+  // writes must not reach the file.
+  p = mmap(0, PGSIZE*3, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap (2)");
+  if(close(fd) == -1)
+    err("close");
+  checkfile(p);
+  for(int i = 0; i < PGSIZE*2; i++)
+    p[i] = 'Z';
+  if(munmap(p, PGSIZE*3) == -1)
+    err("munmap (2)");
+
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*3, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap (3)");
+  checkfile(p);
+  munmap(p, PGSIZE*3);
+  close(fd);
+
+  printf("%s: ok\n", testname);
+}
+
+void
+shared_test(void)
+{
+  const char * const f = "mmap.dur";
+  char *p;
+  int fd;
+
+  testname = "shared";
+  makefile(f);
+
+  // can't write a file through a shared mapping
+  // if it's open read-only.
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*3, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p != MAP_FAILED)
+    err("mmap call should have failed");
+  close(fd);
+
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*3, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap (4)");
+  if(close(fd) == -1)
+    err("close");
+
+  // write the first two pages, and past the end
+  // of the file, which mustn't grow it.
+  for(int i = 0; i < PGSIZE*2; i++)
+    p[i] = 'Z';
+  p[PGSIZE*3 - 1] = 'Z';
+
+  // unmap the first page, then the rest.
+  if(munmap(p, PGSIZE) == -1)
+    err("munmap (4)");
+  if(munmap(p + PGSIZE, PGSIZE*2) == -1)
+    err("munmap (5)");
+
+  struct stat st;
+  char buf[BSIZE];
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  if(fstat(fd, &st) == -1 || st.size != PGSIZE*2 + PGSIZE/2)
+    err("file size changed");
+  for(int i = 0; i < PGSIZE*2 + PGSIZE/2; i += BSIZE){
+    if(read(fd, buf, BSIZE) != BSIZE)
+      err("read");
+    char want = i < PGSIZE*2 ? 'Z' : 'C';
+    for(int j = 0; j < BSIZE; j++){
+      if(buf[j] != want)
+        err("file does not contain modifications");
+    }
+  }
+  close(fd);
+
+  printf("%s: ok\n", testname);
+}
+
+// munmap() from either end, and read() into a
+// mapping of the file being read.
+void
+partial_test(void)
+{
+  const char * const f = "mmap.dur";
+  char *p;
+  int fd;
+
+  testname = "partial";
+  makefile(f);
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p = mmap(0, PGSIZE*3, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  if(munmap(p + PGSIZE, PGSIZE) != -1)
+    err("munmap of a hole should fail");
+  if(munmap(p, PGSIZE) == -1)
+    err("munmap start");
+  if(munmap(p + PGSIZE*2, PGSIZE) == -1)
+    err("munmap end");
+  if(p[PGSIZE] != 'B')
+    err("middle page");
+
+  // read the file's first page over the mapped middle page.
+  if(read(fd, p + PGSIZE, PGSIZE) != PGSIZE)
+    err("read into mapping");
+  for(int i = 0; i < PGSIZE; i++){
+    if(p[PGSIZE+i] != 'A')
+      err("read into mapping contents");
+  }
+  if(munmap(p + PGSIZE, PGSIZE) == -1)
+    err("munmap middle");
+  close(fd);
+
+  printf("%s: ok\n", testname);
+}
+
+// mappings are inherited by fork(); private ones are
+// copied, shared ones reach the file.
+void
+fork_test(void)
+{
+  const char * const f = "mmap.dur";
+  char *p1, *p2;
+  int fd, pid, xstatus;
+
+  testname = "fork";
+  makefile(f);
+  if((fd = open(f, O_RDWR)) == -1)
+    err("open");
+  p1 = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p1 == MAP_FAILED)
+    err("mmap (1)");
+  p2 = mmap(0, PGSIZE*2, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p2 == MAP_FAILED)
+    err("mmap (2)");
+  close(fd);
+
+  // read just the first page of p1 before the fork.
+  if(*p1 != 'A')
+    err("fork mismatch (1)");
+
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    if(p1[0] != 'A' || p1[PGSIZE] != 'B')
+      err("fork mismatch (2)");
+    p1[0] = 'X';
+    for(int i = 0; i < PGSIZE; i++)
+      p2[i] = 'Y';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+
+  if(p1[0] != 'A')
+    err("child's private write visible in parent");
+  if(munmap(p1, PGSIZE*2) == -1 || munmap(p2, PGSIZE*2) == -1)
+    err("munmap");
+
+  char c;
+  if((fd = open(f, O_RDONLY)) == -1)
+    err("open");
+  if(read(fd, &c, 1) != 1 || c != 'Y')
+    err("child's shared write not in file");
+  close(fd);
+  unlink(f);
+
+  printf("%s: ok\n", testname);
+}
+
+int
+main(int argc, char *argv[])
+{
+  private_test();
+  shared_test();
+  partial_test();
+  fork_test();
+  printf("mmaptest: all tests succeeded\n");
+  exit(0);
+}
@@ -0,0 +1,96 @@
+//
+// Measure context-switch throughput with 1..NCPU pairs of
+// processes running in parallel. The two processes of a
+// pair pass a byte back and forth over a pair of pipes, so
+// each round trip is two sleeps, two wakeups and two
+// context switches.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define ROUNDS  2000  // round trips per pair
+
+// pass a byte from in to out, ROUNDS times; the
+// first of the pair starts by writing.
+void
+player(int in, int out, int first)
+{
+  char c = 0;
+  int r;
+
+  for(r = 0; r < ROUNDS; r++){
+    if(first && write(out, &c, 1) != 1)
+      break;
+    if(read(in, &c, 1) != 1)
+      break;
+    if(!first && write(out, &c, 1) != 1)
+      break;
+  }
+  if(r < ROUNDS){
+    printf("schedtest: pipe failed\n");
+    exit(1);
+  }
+  exit(0);
+}
+
+// run n pairs in parallel; returns elapsed ticks.
+int
+run(int n)
+{
+  int i, pid, xstatus, t0, t1;
+  int ab[2], ba[2];
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    if(pipe(ab) < 0 || pipe(ba) < 0){
+      printf("schedtest: pipe failed\n");
+      exit(1);
+    }
+    if((pid = fork()) < 0){
+      printf("schedtest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      player(ba[0], ab[1], 1);
+    if((pid = fork()) < 0){
+      printf("schedtest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      player(ab[0], ba[1], 0);
+    close(ab[0]);
+    close(ab[1]);
+    close(ba[0]);
+    close(ba[1]);
+  }
+  for(i = 0; i < 2*n; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("schedtest: player failed\n");
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  return t1 - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, ticks, switches;
+
+  printf("schedtest: %d round trips per pair\n", ROUNDS);
+  for(n = 1; n <= NCPU; n++){
+    ticks = run(n);
+    switches = 2 * n * ROUNDS;
+    if(ticks == 0)
+      ticks = 1;
+    printf("schedtest: %d pairs: %d switches in %d ticks (%d switches/tick)\n",
+           n, switches, ticks, switches / ticks);
+  }
+  printf("schedtest: OK\n");
+  exit(0);
+}
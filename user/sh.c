@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +132,116 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Is cmd a command, perhaps with redirections?
+int
+simplecmd(struct cmd *cmd)
+{
+  if(cmd->type == REDIR)
+    return simplecmd(((struct redircmd*)cmd)->cmd);
+  return cmd->type == EXEC;
+}
+
+// Can runspawn() run cmd? Simple commands and
+// pipelines of them can be started without fork().
+int
+spawnable(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+
+  if(cmd->type == PIPE){
+    pcmd = (struct pipecmd*)cmd;
+    return simplecmd(pcmd->left) && spawnable(pcmd->right);
+  }
+  return simplecmd(cmd);
+}
+
+// Start the simple command cmd with spawn(). If in or out
+// aren't -1, they become its standard input or output.
+// The child doesn't keep in, out or other open.
+// Returns the child's pid, or -1.
+int
+spawn1(struct cmd *cmd, int in, int out, int other)
+{
+  struct spawnact act[MAXARGS+6];
+  struct redircmd *rcmd;
+  struct execcmd *ecmd;
+  int n = 0, pid;
+
+  memset(act, 0, sizeof(act));
+  if(in >= 0){
+    act[n].op = SPAWN_DUP2;
+    act[n].fd = in;
+    act[n++].newfd = 0;
+  }
+  if(out >= 0){
+    act[n].op = SPAWN_DUP2;
+    act[n].fd = out;
+    act[n++].newfd = 1;
+  }
+  if(in >= 0){
+    act[n].op = SPAWN_CLOSE;
+    act[n++].fd = in;
+  }
+  if(out >= 0){
+    act[n].op = SPAWN_CLOSE;
+    act[n++].fd = out;
+  }
+  if(other >= 0){
+    act[n].op = SPAWN_CLOSE;
+    act[n++].fd = other;
+  }
+
+  // outermost redirection first, as runcmd() does.
+  while(cmd->type == REDIR && n < MAXARGS+5){
+    rcmd = (struct redircmd*)cmd;
+    act[n].op = SPAWN_OPEN;
+    act[n].fd = rcmd->fd;
+    act[n].mode = rcmd->mode;
+    act[n++].path = rcmd->file;
+    cmd = rcmd->cmd;
+  }
+  if(cmd->type != EXEC)
+    return -1;
+
+  ecmd = (struct execcmd*)cmd;
+  if(ecmd->argv[0] == 0)
+    return -1;
+  if((pid = spawn(ecmd->argv[0], ecmd->argv, act)) < 0)
+    fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+  return pid;
+}
+
+// Run a simple command or pipeline with spawn(),
+// and wait for it.
+void
+runspawn(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+  int p[2];
+  int in = -1, n = 0;
+
+  while(cmd->type == PIPE){
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0)
+      panic("pipe");
+    if(spawn1(pcmd->left, in, p[1], p[0]) >= 0)
+      n++;
+    close(p[1]);
+    if(in >= 0)
+      close(in);
+    in = p[0];
+    cmd = pcmd->right;
+  }
+
+  if(spawn1(cmd, in, -1, -1) >= 0)
+    n++;
+  if(in >= 0)
+    close(in);
+
+  while(n-- > 0)
+    wait(0);
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,6 +257,7 @@ int
 main(void)
 {
   static char buf[100];
+  struct cmd *cmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -164,9 +277,18 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    // parse here, not in the child, to see whether
+    // the command can be spawned without a fork.
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(spawnable(cmd)){
+      runspawn(cmd);
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -262,6 +384,19 @@ backcmd(struct cmd *subcmd)
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
 
+int syntaxerr;
+
+// Report a syntax error. The shell itself parses
+// commands, so this mustn't exit; parsecmd()
+// returns 0 instead.
+void
+syntax(char *s)
+{
+  if(!syntaxerr)
+    fprintf(2, "%s\n", s);
+  syntaxerr = 1;
+}
+
 int
 gettoken(char **ps, char *es, char **q, char **eq)
 {
@@ -330,12 +465,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  syntaxerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !syntaxerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(syntaxerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +519,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +547,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +575,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +639,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free the parse tree of cmd.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,108 @@
+//
+// tests for swapping user pages out to disk
+//
+
+#include "kernel/types.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// more memory than the machine has, so that
+// some of it must be in the swap area.
+#define REGION_SZ (PHYSTOP - KERNBASE)
+
+char *region;
+
+void
+err(char *why)
+{
+  printf("swaptest: %s failed, pid=%d\n", why, getpid());
+  exit(1);
+}
+
+// check that each page of the region holds its address.
+void
+check(char *why)
+{
+  for(char *q = region; q < region + REGION_SZ; q += PGSIZE){
+    if(*(char **)q != q){
+      printf("wrong contents at %p\n", q);
+      err(why);
+    }
+  }
+}
+
+// fill all of memory and more, and read it back.
+void
+bigtest(void)
+{
+  printf("big: ");
+  region = sbrk(REGION_SZ);
+  if(region == (char*)0xffffffffffffffffL)
+    err("sbrk");
+  for(char *q = region; q < region + REGION_SZ; q += PGSIZE)
+    *(char **)q = q;
+  check("big");
+  printf("ok\n");
+}
+
+// a child shares the swapped-out pages of its parent.
+void
+forktest(void)
+{
+  int pid, xstatus;
+
+  printf("fork: ");
+  if((pid = fork()) < 0)
+    err("fork");
+  if(pid == 0){
+    check("child");
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  check("parent after fork");
+  printf("ok\n");
+}
+
+// system calls copy to and from swapped-out pages,
+// including under the pipe's lock.
+void
+syscalltest(void)
+{
+  int fds[2];
+  char *p = region + PGSIZE;
+
+  printf("syscall: ");
+  if(pipe(fds) != 0)
+    err("pipe");
+  // the oldest pages are the likeliest to be on disk.
+  for(char *q = region; q < region + 16*PGSIZE; q += PGSIZE){
+    if(write(fds[1], q, sizeof(char *)) != sizeof(char *))
+      err("write from swapped page");
+  }
+  for(char *q = region; q < region + 16*PGSIZE; q += PGSIZE){
+    if(read(fds[0], p, sizeof(char *)) != sizeof(char *))
+      err("read into swapped page");
+    if(*(char **)p != q)
+      err("pipe contents");
+  }
+  *(char **)p = p;
+  close(fds[0]);
+  close(fds[1]);
+  check("syscall");
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  bigtest();
+  forktest();
+  syscalltest();
+  if(sbrk(-REGION_SZ) == (char*)0xffffffffffffffffL)
+    err("sbrk shrink");
+  printf("ALL SWAP TESTS PASSED\n");
+  exit(0);
+}
@@ -0,0 +1,22 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// run a command on only some CPUs:
+// taskset mask command args...
+// where bit i of mask allows CPU i.
+int
+main(int argc, char **argv)
+{
+  if(argc < 3){
+    fprintf(2, "usage: taskset mask command args...\n");
+    exit(1);
+  }
+  if(sched_setaffinity(0, atoi(argv[1])) < 0){
+    fprintf(2, "taskset: bad mask %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "taskset: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -0,0 +1,50 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+// print milliseconds as seconds.
+void
+prms(char *what, uint64 ms)
+{
+  fprintf(2, "%s %d.%d%d%d\n", what, (int)(ms / 1000),
+          (int)(ms / 100 % 10), (int)(ms / 10 % 10), (int)(ms % 10));
+}
+
+// run a command and report the time it took, and the
+// resource usage of it and its children:
+// time command args...
+int
+main(int argc, char **argv)
+{
+  struct rusage ru;
+  int pid, xstatus, t0;
+
+  if(argc < 2){
+    fprintf(2, "usage: time command args...\n");
+    exit(1);
+  }
+  t0 = uptime();
+  if((pid = fork()) < 0){
+    fprintf(2, "time: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "time: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  if(waitru(&xstatus, &ru) < 0){
+    fprintf(2, "time: wait failed\n");
+    exit(1);
+  }
+  prms("real", (uint64)(uptime() - t0) * (TICKCYCLES / MSCYCLES));
+  prms("user", ru.utime / MSCYCLES);
+  prms("sys ", ru.stime / MSCYCLES);
+  prms("wait", ru.wtime / MSCYCLES);
+  fprintf(2, "%d voluntary and %d involuntary context switches\n",
+          ru.nvcsw, ru.nivcsw);
+  fprintf(2, "%d page faults\n", ru.nfault);
+  exit(xstatus);
+}
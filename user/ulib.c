@@ -134,3 +134,143 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// What a thread made by thread_create() is to run, at the
+// top of its stack.
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static void
+threadstart(void *a)
+{
+  struct tstart *ts = a;
+
+  ts->fn(ts->arg);
+  exit(0);
+}
+
+// Start a thread that runs fn(arg) on the stack of size bytes
+// at stack, which must stay allocated until join() returns.
+// The thread exits with status 0 if fn returns.
+// Returns the thread's id, for join(), or -1.
+int
+thread_create(void (*fn)(void*), void *arg, void *stack, int size)
+{
+  struct tstart *ts;
+
+  // the stack pointer must be 16-byte aligned.
+  ts = (struct tstart*)(((uint64)stack + size) & ~15L) - 1;
+  ts->fn = fn;
+  ts->arg = arg;
+  return clone(threadstart, ts, ts);
+}
+
+// Mutexes, condition variables and semaphores, which only
+// make system calls when a thread has to wait, or another
+// is waiting. A mutex's state is 0 if it's unlocked, 1 if
+// it's locked, and 2 if it's locked and threads may be
+// sleeping in futex_wait() for it.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+  c->nwait = 0;
+}
+
+// Unlock m, wait for cond_signal() or cond_broadcast(), and
+// lock m again. The wait may end early, so the caller must
+// check its condition again.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq;
+
+  __sync_fetch_and_add(&c->nwait, 1);
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  __sync_fetch_and_sub(&c->nwait, 1);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->nwait > 0)
+    futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->nwait > 0)
+    futex_wake(&c->seq, c->nwait);
+}
+
+void
+sem_init(struct sem *s, int n)
+{
+  s->count = n;
+  s->nwait = 0;
+}
+
+void
+sem_wait(struct sem *s)
+{
+  int c;
+
+  for(;;){
+    c = s->count;
+    if(c > 0){
+      if(__sync_bool_compare_and_swap(&s->count, c, c - 1))
+        return;
+      continue;
+    }
+    __sync_fetch_and_add(&s->nwait, 1);
+    futex_wait(&s->count, c);
+    __sync_fetch_and_sub(&s->nwait, 1);
+  }
+}
+
+void
+sem_post(struct sem *s)
+{
+  __sync_fetch_and_add(&s->count, 1);
+  if(s->nwait > 0)
+    futex_wake(&s->count, 1);
+}
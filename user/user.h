@@ -1,5 +1,20 @@
 struct stat;
 struct rtcdate;
+struct spawnact;
+struct rusage;
+
+// ulib.c's thread synchronization; see mutex_lock() &c.
+struct mutex {
+  volatile int state;
+};
+struct cond {
+  volatile int seq;
+  volatile int nwait;
+};
+struct sem {
+  volatile int count;
+  volatile int nwait;
+};
 
 // system calls
 int fork(void);
@@ -23,6 +38,19 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void *mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int spawn(const char*, char**, struct spawnact*);
+int setpriority(int, int);
+int msleep(int);
+int getrusage(int, struct rusage*);
+int waitru(int*, struct rusage*);
+int sched_setaffinity(int, int);
+int sched_getaffinity(int);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(volatile int*, int);
+int futex_wake(volatile int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +68,14 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int thread_create(void (*)(void*), void*, void*, int);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void sem_init(struct sem*, int);
+void sem_wait(struct sem*);
+void sem_post(struct sem*);
@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/spawn.h"
+#include "kernel/rusage.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -680,6 +682,88 @@ exectest(char *s)
 
 }
 
+// spawn() with its output redirected, and through a pipe.
+void
+spawntest(char *s)
+{
+  int fd, xstatus, pid, fds[2], n, cc;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[3];
+  struct spawnact act[4];
+
+  // redirect to a file.
+  unlink("spawn-ok");
+  memset(act, 0, sizeof(act));
+  act[0].op = SPAWN_OPEN;
+  act[0].fd = 1;
+  act[0].mode = O_CREATE|O_WRONLY;
+  act[0].path = "spawn-ok";
+  if((pid = spawn("echo", echoargv, act)) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  fd = open("spawn-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output in file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spawn-ok");
+
+  // write to a pipe; the child mustn't keep the read end.
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  memset(act, 0, sizeof(act));
+  act[0].op = SPAWN_DUP2;
+  act[0].fd = fds[1];
+  act[0].newfd = 1;
+  act[1].op = SPAWN_CLOSE;
+  act[1].fd = fds[0];
+  act[2].op = SPAWN_CLOSE;
+  act[2].fd = fds[1];
+  if((pid = spawn("echo", echoargv, act)) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  n = 0;
+  while(n < sizeof(buf) && (cc = read(fds[0], buf + n, sizeof(buf) - n)) > 0)
+    n += cc;
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K' || read(fds[0], buf, 1) != 0){
+    printf("%s: wrong output in pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  // failures leave no child behind.
+  if(spawn("nosuchfile", echoargv, 0) >= 0){
+    printf("%s: spawn of missing file succeeded\n", s);
+    exit(1);
+  }
+  memset(act, 0, sizeof(act));
+  act[0].op = SPAWN_DUP2;
+  act[0].fd = NOFILE-1;
+  act[0].newfd = 1;
+  if(spawn("echo", echoargv, act) >= 0){
+    printf("%s: spawn with a bad fd succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -735,6 +819,34 @@ pipe1(char *s)
   }
 }
 
+// a read from a pipe into a bad address must fail
+// without consuming the bytes it couldn't copy out.
+void
+pipebadread(char *s)
+{
+  int fds[2];
+  char c[2];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "ab", 2) != 2){
+    printf("%s: pipe write failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], (void*)0xffffffffffffffffULL, 1) != -1){
+    printf("%s: read into a bad address didn't fail\n", s);
+    exit(1);
+  }
+  if(read(fds[0], c, 2) != 2 || c[0] != 'a' || c[1] != 'b'){
+    printf("%s: bytes lost by a failed read\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -2229,6 +2341,188 @@ bsstest(char *s)
   }
 }
 
+// exec() reads in a program's pages only when they are
+// first touched. a pipe write() from initialized data,
+// and a read() into bss, must each fault in pages that
+// nothing has touched yet, with the pipe's lock held.
+char lazyinit[3*4096] = { 'x', [4096] = 'y', [2*4096] = 'z' };
+char lazybss[3*4096];
+void
+lazyexec(char *s)
+{
+  int fds[2], n, tot;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fork() == 0){
+    if(write(fds[1], lazyinit, sizeof(lazyinit)) != sizeof(lazyinit)){
+      printf("%s: write from data failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  for(tot = 0; tot < sizeof(lazybss); tot += n){
+    if((n = read(fds[0], lazybss + tot, sizeof(lazybss) - tot)) <= 0){
+      printf("%s: read into bss failed\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(lazybss[0] != 'x' || lazybss[4096] != 'y' || lazybss[2*4096] != 'z' ||
+     lazybss[1] != 0 || lazybss[sizeof(lazybss)-1] != 0){
+    printf("%s: wrong contents\n", s);
+    exit(1);
+  }
+}
+
+// copy file from to file to, replacing what was there.
+void
+copyfile(char *s, char *from, char *to)
+{
+  int fd1, fd2, n;
+  char cbuf[512];
+
+  if((fd1 = open(from, O_RDONLY)) < 0 ||
+     (fd2 = open(to, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("%s: open %s or %s failed\n", s, from, to);
+    exit(1);
+  }
+  while((n = read(fd1, cbuf, sizeof(cbuf))) > 0){
+    if(write(fd2, cbuf, n) != n){
+      printf("%s: write %s failed\n", s, to);
+      exit(1);
+    }
+  }
+  close(fd1);
+  close(fd2);
+}
+
+// run program path with no arguments and in as its
+// input, and check that it prints want.
+void
+runcheck(char *s, char *path, char *in, char *want)
+{
+  int infd[2], outfd[2], n, tot, xstatus;
+  char out[32];
+  char *argv[] = { path, 0 };
+
+  if(pipe(infd) != 0 || pipe(outfd) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fork() == 0){
+    close(0);
+    dup(infd[0]);
+    close(1);
+    dup(outfd[1]);
+    close(infd[0]);
+    close(infd[1]);
+    close(outfd[0]);
+    close(outfd[1]);
+    exec(path, argv);
+    exit(1);
+  }
+  close(infd[0]);
+  close(outfd[1]);
+  write(infd[1], in, strlen(in));
+  close(infd[1]);
+  for(tot = 0; tot < sizeof(out) - 1; tot += n){
+    if((n = read(outfd[0], out + tot, sizeof(out) - 1 - tot)) <= 0)
+      break;
+  }
+  out[tot] = 0;
+  close(outfd[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || strcmp(out, want) != 0){
+    printf("%s: %s printed \"%s\", wanted \"%s\"\n", s, path, out, want);
+    exit(1);
+  }
+}
+
+// exec() shares cached text pages between processes
+// running the same program, so rewriting a program must
+// drop its cached pages.
+void
+textcache(char *s)
+{
+  copyfile(s, "echo", "txtprog");
+  runcheck(s, "txtprog", "in", "\n");
+  runcheck(s, "txtprog", "in", "\n");
+  copyfile(s, "cat", "txtprog");
+  runcheck(s, "txtprog", "in", "in");
+  unlink("txtprog");
+}
+
+// a running program can't be rewritten or truncated, since
+// its pages are read from the file as they're touched.
+void
+textbusy(char *s)
+{
+  int infd[2], outfd[2], fd, xstatus;
+  char c;
+  char *argv[] = { "txtbusy", 0 };
+
+  copyfile(s, "cat", "txtbusy");
+  if(pipe(infd) != 0 || pipe(outfd) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fork() == 0){
+    close(0);
+    dup(infd[0]);
+    close(1);
+    dup(outfd[1]);
+    close(infd[0]);
+    close(infd[1]);
+    close(outfd[0]);
+    close(outfd[1]);
+    exec("txtbusy", argv);
+    exit(1);
+  }
+  close(infd[0]);
+  close(outfd[1]);
+
+  // once cat echoes a byte, it's running.
+  if(write(infd[1], "x", 1) != 1 || read(outfd[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: txtbusy didn't run\n", s);
+    exit(1);
+  }
+  if(open("txtbusy", O_WRONLY|O_TRUNC) >= 0){
+    printf("%s: truncated a running program\n", s);
+    exit(1);
+  }
+  if((fd = open("txtbusy", O_WRONLY)) < 0){
+    printf("%s: open txtbusy failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "\0", 1) != -1){
+    printf("%s: wrote a running program\n", s);
+    exit(1);
+  }
+
+  // it can be rewritten once it has exited.
+  close(infd[1]);
+  close(outfd[0]);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: txtbusy failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "\0", 1) != 1){
+    printf("%s: can't write an exited program\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("txtbusy");
+}
+
 // does exec return an error if the arguments
 // are larger than a page? or does it write
 // below the stack and wreck the instructions/data?
@@ -2349,7 +2643,7 @@ stacktest(char *s)
   pid = fork();
   if(pid == 0) {
     char *sp = (char *) r_sp();
-    sp -= PGSIZE;
+    sp -= MAXSTACK*PGSIZE;
     // the *sp should cause a trap.
     printf("%s: stacktest: read below stack %p\n", *sp);
     exit(1);
@@ -2364,6 +2658,448 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// use up to n bytes of stack, a page per call.
+int
+recurse(int n)
+{
+  volatile char buf[PGSIZE];
+
+  buf[0] = n;
+  buf[PGSIZE-1] = n;
+  if(n <= PGSIZE)
+    return buf[0] + buf[PGSIZE-1];
+  return recurse(n - PGSIZE) + buf[0] - buf[PGSIZE-1];
+}
+
+// the stack grows as it's used, up to MAXSTACK pages;
+// a process that overflows it is killed.
+void
+stackgrow(char *s)
+{
+  int pid, xstatus;
+
+  // more than half the limit, and system calls
+  // that copy to and from the grown stack.
+  char *argv[] = { "echo", "ok", 0 };
+  recurse(MAXSTACK/2*PGSIZE);
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    exec("echo", argv);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: exec with a grown stack failed\n", s);
+    exit(1);
+  }
+
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    recurse(2*MAXSTACK*PGSIZE);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: stack overflow wasn't caught\n", s);
+    exit(1);
+  }
+}
+
+// setpriority() checks its arguments, returns the old
+// nice value, and a child inherits its parent's.
+void
+setprio(char *s)
+{
+  int pid, xstatus;
+
+  if(setpriority(0, NPRIO) != -1 || setpriority(0, -1) != -1){
+    printf("%s: setpriority accepted a bad level\n", s);
+    exit(1);
+  }
+  if(setpriority(0, NPRIO-1) != 0){
+    printf("%s: setpriority(0, %d) failed\n", s, NPRIO-1);
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(setpriority(0, 0) == NPRIO-1 ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child didn't inherit its nice value\n", s);
+    exit(1);
+  }
+  if(setpriority(getpid(), 0) != NPRIO-1){
+    printf("%s: setpriority by pid failed\n", s);
+    exit(1);
+  }
+  if(setpriority(pid, 0) != -1){
+    printf("%s: setpriority of a dead process succeeded\n", s);
+    exit(1);
+  }
+}
+
+// msleep() sleeps for less than a clock tick, and
+// several children sleeping at once all wake up.
+void
+msleeptest(char *s)
+{
+  int i, t0, t1, pid, xstatus;
+
+  // 20 sleeps of 10 ms are two ticks' worth; if each
+  // lasted until the next tick, they'd take 20 ticks.
+  t0 = uptime();
+  for(i = 0; i < 20; i++){
+    if(msleep(10) != 0){
+      printf("%s: msleep failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  if(t1 - t0 < 1 || t1 - t0 > 10){
+    printf("%s: 200 ms of msleep took %d ticks\n", s, t1 - t0);
+    exit(1);
+  }
+
+  for(i = 0; i < 8; i++){
+    if((pid = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0)
+      exit(msleep(5 * (8 - i)) == 0 && sleep(1) == 0 ? 0 : 1);
+  }
+  for(i = 0; i < 8; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child's msleep failed\n", s);
+      exit(1);
+    }
+  }
+}
+
+// waitru() and getrusage() report a child's CPU time, context
+// switches and page faults.
+void
+rusagetest(char *s)
+{
+  struct rusage ru, before, after;
+  int i, pid, xstatus, t0;
+  char *a;
+
+  if(getrusage(RUSAGE_SELF, &ru) < 0 || getrusage(2, &ru) != -1 ||
+     getrusage(RUSAGE_CHILDREN, &before) < 0){
+    printf("%s: getrusage failed\n", s);
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // use up a few time slices, sleep, and fault in
+    // some heap pages.
+    t0 = uptime();
+    while(uptime() - t0 < 3)
+      ;
+    sleep(1);
+    if((a = sbrk(8*PGSIZE)) == (char*)-1)
+      exit(1);
+    for(i = 0; i < 8; i++)
+      a[i*PGSIZE] = 1;
+    exit(0);
+  }
+  if(waitru(&xstatus, &ru) != pid || xstatus != 0){
+    printf("%s: waitru failed\n", s);
+    exit(1);
+  }
+  if(ru.utime == 0 || ru.stime == 0 || ru.nvcsw < 1 || ru.nivcsw < 1 ||
+     ru.nfault < 8){
+    printf("%s: child's usage utime %d stime %d nvcsw %d nivcsw %d nfault %d\n",
+           s, (int)ru.utime, (int)ru.stime, ru.nvcsw, ru.nivcsw, ru.nfault);
+    exit(1);
+  }
+  if(getrusage(RUSAGE_CHILDREN, &after) < 0 ||
+     after.utime != before.utime + ru.utime ||
+     after.nfault != before.nfault + ru.nfault){
+    printf("%s: children's usage doesn't add up\n", s);
+    exit(1);
+  }
+}
+
+// sched_setaffinity() checks its arguments, a pinned process
+// keeps running, and a child inherits its parent's mask.
+void
+affinity(char *s)
+{
+  int all, last, pid, xstatus, t0;
+
+  if((all = sched_getaffinity(0)) <= 0){
+    printf("%s: sched_getaffinity failed\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(0, 0) != -1 || sched_setaffinity(0, ~all) != -1){
+    printf("%s: sched_setaffinity accepted a mask of no CPUs\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(0, all & -all) != 0 || sched_getaffinity(0) != (all & -all)){
+    printf("%s: sched_setaffinity failed\n", s);
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // move to the last CPU, and run there for a while.
+    if(sched_getaffinity(0) != (all & -all))
+      exit(1);
+    for(last = all; last & (last - 1); last &= last - 1)
+      ;
+    if(sched_setaffinity(0, last) != 0 || sched_getaffinity(0) != last)
+      exit(1);
+    t0 = uptime();
+    while(uptime() - t0 < 2)
+      ;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child's affinity is wrong\n", s);
+    exit(1);
+  }
+  if(sched_setaffinity(pid, all) != -1){
+    printf("%s: sched_setaffinity of a dead process succeeded\n", s);
+    exit(1);
+  }
+  sched_setaffinity(0, all);
+}
+
+// threads made by clone() share memory, including memory
+// that one of them sbrk()s or faults in, and open files;
+// join() collects their exit status; and a thread loses
+// memory that another frees, rather than using it through
+// a stale TLB entry. exit() takes a process's threads with it.
+#define TPAGES 64
+static char tstacks[4][2*4096] __attribute__((aligned(16)));
+static char *tregion;
+static char *theap;
+static int tpipe[2];
+
+void
+threadtouch(void *arg)
+{
+  int i, me = (uint64)arg;
+
+  for(i = 0; i < TPAGES; i++)
+    tregion[i*PGSIZE + me] = me + 1;
+  exit(me);
+}
+
+void
+threadsbrk(void *arg)
+{
+  if((theap = sbrk(PGSIZE)) == (char*)-1 || pipe(tpipe) < 0)
+    exit(1);
+  theap[0] = 'x';
+}
+
+void
+threadread(void *arg)
+{
+  for(;;)
+    (void)*(volatile char *)tregion;
+}
+
+void
+threadspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+void
+threads(char *s)
+{
+  int i, tid[4], pid, xstatus;
+  char c;
+
+  // all four store to every page of new heap memory at once.
+  if((tregion = sbrk(TPAGES*PGSIZE)) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    tid[i] = thread_create(threadtouch, (void*)(uint64)i, tstacks[i], sizeof(tstacks[i]));
+    if(tid[i] < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(join(tid[i], &xstatus) != tid[i] || xstatus != i){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < TPAGES*4; i++){
+    if(tregion[(i/4)*PGSIZE + i%4] != i%4 + 1){
+      printf("%s: a thread's store is missing\n", s);
+      exit(1);
+    }
+  }
+  if(join(tid[0], 0) != -1 || join(getpid(), 0) != -1){
+    printf("%s: joined a thread twice, or the leader\n", s);
+    exit(1);
+  }
+
+  // a thread's sbrk() and pipe() are the process's.
+  tid[0] = thread_create(threadsbrk, 0, tstacks[0], sizeof(tstacks[0]));
+  if(tid[0] < 0 || join(tid[0], &xstatus) != tid[0] || xstatus != 0){
+    printf("%s: thread failed\n", s);
+    exit(1);
+  }
+  if(theap[0] != 'x' || sbrk(0) != theap + PGSIZE){
+    printf("%s: thread's sbrk isn't shared\n", s);
+    exit(1);
+  }
+  if(write(tpipe[1], "y", 1) != 1 || read(tpipe[0], &c, 1) != 1 || c != 'y'){
+    printf("%s: thread's pipe isn't shared\n", s);
+    exit(1);
+  }
+  close(tpipe[0]);
+  close(tpipe[1]);
+
+  // a thread reading memory that's freed under it faults.
+  tid[0] = thread_create(threadread, 0, tstacks[0], sizeof(tstacks[0]));
+  if(tid[0] < 0){
+    printf("%s: thread_create failed\n", s);
+    exit(1);
+  }
+  sleep(1);
+  sbrk(-(PGSIZE + TPAGES*PGSIZE));
+  if(join(tid[0], &xstatus) != tid[0] || xstatus != -1){
+    printf("%s: thread kept reading freed memory\n", s);
+    exit(1);
+  }
+
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < 4; i++){
+      if(thread_create(threadspin, 0, tstacks[i], sizeof(tstacks[i])) < 0)
+        exit(1);
+    }
+    sleep(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child with threads failed\n", s);
+    exit(1);
+  }
+}
+
+// threads that share a counter under a mutex, and pass items
+// through a queue guarded by a condition variable and counted
+// by a semaphore, lose nothing; futex_wait() doesn't sleep if
+// the value has changed.
+#define FITEMS 1000
+static struct mutex fmutex;
+static struct cond fcond;
+static struct sem fsem;
+static int fcount, fqueue[4], fhead, ftail;
+static int fsum;
+
+void
+futexcount(void *arg)
+{
+  for(int i = 0; i < FITEMS; i++){
+    mutex_lock(&fmutex);
+    fcount++;
+    mutex_unlock(&fmutex);
+  }
+}
+
+// put 1..FITEMS in the queue.
+void
+futexput(void *arg)
+{
+  for(int i = 1; i <= FITEMS; i++){
+    sem_wait(&fsem);  // a free slot
+    mutex_lock(&fmutex);
+    fqueue[ftail++ % 4] = i;
+    cond_signal(&fcond);
+    mutex_unlock(&fmutex);
+  }
+}
+
+void
+futex(char *s)
+{
+  int i, tid[4], xstatus;
+  volatile int v = 1;
+
+  if(futex_wait(&v, 2) != -1 || futex_wait((int*)1, 0) != -1){
+    printf("%s: futex_wait slept\n", s);
+    exit(1);
+  }
+  if(futex_wake(&v, 1) != 0){
+    printf("%s: futex_wake woke a thread\n", s);
+    exit(1);
+  }
+
+  mutex_init(&fmutex);
+  for(i = 0; i < 4; i++){
+    tid[i] = thread_create(futexcount, 0, tstacks[i], sizeof(tstacks[i]));
+    if(tid[i] < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(join(tid[i], &xstatus) != tid[i] || xstatus != 0){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+  }
+  if(fcount != 4*FITEMS){
+    printf("%s: count %d, not %d\n", s, fcount, 4*FITEMS);
+    exit(1);
+  }
+
+  cond_init(&fcond);
+  sem_init(&fsem, 4);
+  if((tid[0] = thread_create(futexput, 0, tstacks[0], sizeof(tstacks[0]))) < 0){
+    printf("%s: thread_create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < FITEMS; i++){
+    mutex_lock(&fmutex);
+    while(fhead == ftail)
+      cond_wait(&fcond, &fmutex);
+    fsum += fqueue[fhead++ % 4];
+    mutex_unlock(&fmutex);
+    sem_post(&fsem);
+  }
+  if(join(tid[0], &xstatus) != tid[0] || xstatus != 0 ||
+     fsum != FITEMS*(FITEMS+1)/2){
+    printf("%s: lost items from the queue\n", s);
+    exit(1);
+  }
+}
+
 // regression test. copyin(), copyout(), and copyinstr() used to cast
 // the virtual page address to uint, which (with certain wild system
 // call arguments) resulted in a kernel page faults.
@@ -2437,6 +3173,41 @@ sbrkbugs(char *s)
   exit(0);
 }
 
+int countfree();
+
+// shrinking the heap should free the page-table pages that
+// mapped it, not just the pages themselves.
+void
+sbrkpgtbl(char *s)
+{
+  int free0, free1, i, n = 32;
+  char *a;
+  volatile char c;
+
+  free0 = countfree();
+  for(i = 0; i < 4; i++){
+    a = sbrk(n * MEGAPGSIZE);
+    if(a == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    // a read in each megapage of the heap maps the zero
+    // page there, and needs a level-0 page-table page.
+    for(char *q = a; q < a + n * MEGAPGSIZE; q += MEGAPGSIZE)
+      c = *q;
+    if(sbrk(-n * MEGAPGSIZE) == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk shrink failed\n", s);
+      exit(1);
+    }
+  }
+  free1 = countfree();
+  if(free0 - free1 > n / 2){
+    printf("%s: %d pages leaked\n", s, free0 - free1);
+    exit(1);
+  }
+  (void)c;
+}
+
 // regression test. does write() with an invalid buffer pointer cause
 // a block to be allocated for a file that is then not freed when the
 // file is deleted? if the kernel has this bug, it will panic: balloc:
@@ -2650,6 +3421,14 @@ main(int argc, char *argv[])
     {reparent2, "reparent2"},
     {pgbug, "pgbug" },
     {sbrkbugs, "sbrkbugs" },
+    {sbrkpgtbl, "sbrkpgtbl" },
+    {stackgrow, "stackgrow" },
+    {setprio, "setprio" },
+    {msleeptest, "msleep" },
+    {rusagetest, "rusage" },
+    {affinity, "affinity" },
+    {threads, "threads" },
+    {futex, "futex" },
     // {badwrite, "badwrite" },
     {badarg, "badarg" },
     {reparent, "reparent" },
@@ -2666,9 +3445,13 @@ main(int argc, char *argv[])
     {fourfiles, "fourfiles"},
     {sharedfd, "sharedfd"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
+    {lazyexec, "lazyexec"},
+    {textcache, "textcache"},
+    {textbusy, "textbusy"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
     {kernmem, "kernmem"},
@@ -2685,6 +3468,7 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {pipebadread, "pipebadread"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
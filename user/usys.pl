@@ -36,3 +36,16 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("spawn");
+entry("setpriority");
+entry("msleep");
+entry("getrusage");
+entry("waitru");
+entry("sched_setaffinity");
+entry("sched_getaffinity");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");